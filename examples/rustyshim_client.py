@@ -1,5 +1,19 @@
+import pyarrow as pa
 import pyarrow.flight as pf
 
+# A path descriptor also carrying a command, which pyarrow cannot build directly
+def _path_descriptor(path, cmd):
+    def field(number, data):
+        header, n = bytearray([number << 3 | 2]), len(data)
+        while n >= 0x80:
+            header.append(n & 0x7f | 0x80)
+            n >>= 7
+        header.append(n)
+        return bytes(header) + data
+    message = b"\x08\x01" + field(2, cmd.encode("utf-8"))
+    message += b"".join(field(3, p.encode("utf-8")) for p in path)
+    return pf.FlightDescriptor.deserialize(message)
+
 class RustyShimConnection:
     class AuthHandler(pf.ClientAuthHandler):
         def __init__(self, username, password, request_admin):
@@ -18,11 +32,16 @@ class RustyShimConnection:
             return self.token
     
     def __init__(self, host, username, password, request_admin, port, scheme):
-        location = scheme + "://" + host + ":" + str(port)
+        if scheme == "grpc+unix":
+            # host is the path of the server's Unix domain socket
+            location = scheme + "://" + host
+        else:
+            location = scheme + "://" + host + ":" + str(port)
         self.client = pf.connect(location)
         h = RustyShimConnection.AuthHandler(username, password, request_admin)
         self.client.authenticate(h)
-        self.options = pf.FlightCallOptions(headers=[(b'authorization',h.get_token())])
+        self.headers = [(b'authorization',h.get_token())]
+        self.options = pf.FlightCallOptions(headers=self.headers)
     
     def list_actions(self):
         return self.client.list_actions(self.options)
@@ -33,11 +52,90 @@ class RustyShimConnection:
     def clear_expired_items(self):
         return [r.body.to_pybytes().decode("utf-8") for r in self.client.do_action("CLEAR_EXPIRED_ITEMS", self.options)]
     
-    def get_sql(self, query):
+    def reload_token_keys(self):
+        return [r.body.to_pybytes().decode("utf-8") for r in self.client.do_action("RELOAD_TOKEN_KEYS", self.options)]
+
+    def memory_usage(self):
+        return [r.body.to_pybytes().decode("utf-8") for r in self.client.do_action("MEMORY_USAGE", self.options)]
+
+    def cancel_query(self, ticket):
+        action = pf.Action("CANCEL_QUERY", ticket.ticket if isinstance(ticket, pf.Ticket) else ticket)
+        return [r.body.to_pybytes().decode("utf-8") for r in self.client.do_action(action, self.options)]
+
+    def export_result(self, ticket):
+        action = pf.Action("EXPORT_RESULT", ticket.ticket if isinstance(ticket, pf.Ticket) else ticket)
+        return [r.body.to_pybytes().decode("utf-8") for r in self.client.do_action(action, self.options)]
+
+    def get_sql_shm(self, query):
+        path = self.export_result(self.get_ticket(query))[1]
+        return pa.ipc.open_file(pa.memory_map(path)).read_all()
+
+    def put_table(self, name, table):
+        writer, reader = self.client.do_put(pf.FlightDescriptor.for_path(name), table.schema, self.options)
+        writer.write_table(table)
+        writer.done_writing()
+        result = reader.read()
+        writer.close()
+        return None if result is None else result.to_pybytes().decode("utf-8")
+
+    def store_array(self, array, table, transform=None):
+        descriptor = _path_descriptor(["scidb", array], transform or "")
+        writer, reader = self.client.do_put(descriptor, table.schema, self.options)
+        writer.write_table(table)
+        writer.done_writing()
+        result = reader.read()
+        writer.close()
+        return None if result is None else result.to_pybytes().decode("utf-8")
+
+    def lookup(self, table, keys, key_table, batch_size=65536):
+        writer, reader = self.client.do_exchange(pf.FlightDescriptor.for_path(table, *keys), self.options)
+        with writer:
+            writer.begin(key_table.schema)
+            for batch in key_table.to_batches(max_chunksize=batch_size):
+                writer.write_batch(batch)
+                yield reader.read_chunk().data
+            writer.done_writing()
+
+    def drop_temp_table(self, name):
+        return [r.body.to_pybytes().decode("utf-8") for r in self.client.do_action(pf.Action("DROP_TEMP_TABLE", name.encode("utf-8")), self.options)]
+
+    def get_ticket(self, query):
         fd = pf.FlightDescriptor.for_path(query)
         fi = self.client.get_flight_info(fd, self.options)
-        ep = fi.endpoints[0]
-        return self.client.do_get(ep.ticket, self.options)
+        return fi.endpoints[0].ticket
+
+    def execute_batch(self, queries):
+        action = pf.Action("EXECUTE_BATCH", ";\n".join(queries).encode("utf-8"))
+        return [r.body.to_pybytes() for r in self.client.do_action(action, self.options)][1:]
+
+    def fetch(self, ticket, offset=None, limit=None, batch=None, timeout=None):
+        t = ticket.ticket if isinstance(ticket, pf.Ticket) else ticket
+        if batch is not None:
+            t += b";batch=%d" % batch
+        if offset is not None:
+            t += b";offset=%d" % offset
+        if limit is not None:
+            t += b";limit=%d" % limit
+        options = self.options if timeout is None else pf.FlightCallOptions(headers=self.headers, timeout=timeout)
+        return self.client.do_get(pf.Ticket(t), options)
+
+    def fetch_all(self, ticket, retries=3, timeout=None):
+        batches = []
+        rows = 0
+        while True:
+            try:
+                reader = self.fetch(ticket, offset=rows, timeout=timeout)
+                for chunk in reader:
+                    batches.append(chunk.data)
+                    rows += chunk.data.num_rows
+                return pa.Table.from_batches(batches, reader.schema)
+            except pf.FlightError:
+                if retries == 0:
+                    raise
+                retries -= 1
+
+    def get_sql(self, query, timeout=None):
+        return self.fetch(self.get_ticket(query), timeout=timeout)
 
 def rustyshim_connect(host, username, password, request_admin=False, port=50051, scheme = "grpc+tcp"):
     return RustyShimConnection(host, username, password, request_admin, port, scheme)
\ No newline at end of file
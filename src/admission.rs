@@ -0,0 +1,319 @@
+use std::collections::{HashMap, VecDeque};
+use std::sync::{Arc, Mutex};
+use std::time::{Duration, Instant};
+use tokio::sync::oneshot;
+
+///////////////////////
+// Admission control //
+///////////////////////
+
+/* Queries are admitted for execution only while fewer than max_concurrent
+ * queries are running and the sum of their estimated memory stays within
+ * max_memory. Other queries wait in priority queues: admin queries are
+ * always dispatched first, and regular queries are dispatched round-robin
+ * across users so that one user's burst cannot starve everyone else.
+ * Dispatch is strictly in that order, so a large query at the head of the
+ * queue is not overtaken indefinitely by smaller ones.
+ *
+ * When the queue is full, or a query waits longer than queue_timeout, the
+ * query is rejected along with a hint of when to retry, derived from the
+ * recent average query duration and the current backlog. A query that stops
+ * waiting otherwise, as when its request is cancelled or its deadline
+ * passes, leaves the queue right away.
+ */
+
+#[derive(Clone, Debug)]
+pub struct AdmissionConfig {
+    pub max_concurrent: usize,
+    pub max_memory: usize,
+    pub max_queued: usize,
+    pub queue_timeout: Duration,
+}
+
+impl Default for AdmissionConfig {
+    fn default() -> Self {
+        AdmissionConfig {
+            max_concurrent: std::thread::available_parallelism().map_or(1, |n| n.get()),
+            max_memory: usize::MAX,
+            max_queued: 1000,
+            queue_timeout: Duration::from_secs(30),
+        }
+    }
+}
+
+#[derive(Clone, Copy, PartialEq)]
+pub enum Priority {
+    Admin,
+    Regular,
+}
+
+#[derive(Debug)]
+pub struct Rejection {
+    pub reason: &'static str,
+    pub retry_after: Duration,
+}
+
+struct Waiter {
+    id: u64,
+    memory: usize,
+    grant: oneshot::Sender<()>,
+}
+
+struct AdmissionState {
+    running: usize,
+    memory: usize,
+    queued: usize,
+    next_id: u64,
+    admin_queue: VecDeque<Waiter>,
+    user_queues: HashMap<Arc<str>, VecDeque<Waiter>>,
+    // Users with waiting queries, in round-robin order
+    user_order: VecDeque<Arc<str>>,
+    // Exponentially weighted average of query durations, in seconds
+    avg_duration: f64,
+}
+
+pub struct AdmissionController {
+    config: AdmissionConfig,
+    state: Mutex<AdmissionState>,
+}
+
+pub struct AdmissionPermit {
+    controller: Arc<AdmissionController>,
+    memory: usize,
+    start: Instant,
+}
+
+impl Drop for AdmissionPermit {
+    fn drop(&mut self) {
+        self.controller.release(self.memory, self.start.elapsed());
+    }
+}
+
+// A waiter in the queue, withdrawn from it if dropped before its wait is
+// settled
+struct Queued {
+    controller: Arc<AdmissionController>,
+    user: Arc<str>,
+    id: u64,
+    memory: usize,
+    rx: oneshot::Receiver<()>,
+    settled: bool,
+}
+
+impl Queued {
+    // Withdraw the waiter from the queue, returning whether it was admitted
+    // concurrently
+    fn withdraw(&mut self) -> bool {
+        self.settled = true;
+        let mut state = self.controller.state.lock().unwrap();
+        if state.remove_waiter(&self.user, self.id) {
+            // The waiter may have been blocking the head of the queue
+            self.controller.dispatch(&mut state);
+            return false;
+        }
+        // Dispatched concurrently; the grant was sent to the receiver we
+        // still hold
+        self.rx.try_recv().is_ok()
+    }
+}
+
+impl Drop for Queued {
+    fn drop(&mut self) {
+        if !self.settled && self.withdraw() {
+            // Admitted but never run: give back what it was granted
+            let mut state = self.controller.state.lock().unwrap();
+            state.running -= 1;
+            state.memory -= self.memory;
+            self.controller.dispatch(&mut state);
+        }
+    }
+}
+
+impl AdmissionState {
+    fn fits(&self, config: &AdmissionConfig, memory: usize) -> bool {
+        self.running < config.max_concurrent
+            && self.memory.saturating_add(memory) <= config.max_memory
+    }
+
+    // Pop the next waiter in priority order if it can be admitted now
+    fn pop_next(&mut self, config: &AdmissionConfig) -> Option<Waiter> {
+        if let Some(waiter) = self.admin_queue.front() {
+            if !self.fits(config, waiter.memory) {
+                return None;
+            }
+            return self.admin_queue.pop_front();
+        }
+        let user = self.user_order.front()?.clone();
+        let memory = self.user_queues.get(&user)?.front()?.memory;
+        if !self.fits(config, memory) {
+            return None;
+        }
+        let queue = self.user_queues.get_mut(&user)?;
+        let waiter = queue.pop_front();
+        let exhausted = queue.is_empty();
+        // Rotate the user to the back, or forget them if they have no more
+        self.user_order.pop_front();
+        if exhausted {
+            self.user_queues.remove(&user);
+        } else {
+            self.user_order.push_back(user);
+        }
+        waiter
+    }
+
+    fn remove_waiter(&mut self, user: &Arc<str>, id: u64) -> bool {
+        let removed = if let Some(pos) = self.admin_queue.iter().position(|w| w.id == id) {
+            self.admin_queue.remove(pos).is_some()
+        } else if let Some(queue) = self.user_queues.get_mut(user) {
+            let removed = queue
+                .iter()
+                .position(|w| w.id == id)
+                .and_then(|pos| queue.remove(pos))
+                .is_some();
+            if queue.is_empty() {
+                self.user_queues.remove(user);
+                self.user_order.retain(|u| u != user);
+            }
+            removed
+        } else {
+            false
+        };
+        if removed {
+            self.queued -= 1;
+        }
+        removed
+    }
+}
+
+impl AdmissionController {
+    pub fn new(config: AdmissionConfig) -> Self {
+        AdmissionController {
+            config: config,
+            state: Mutex::new(AdmissionState {
+                running: 0,
+                memory: 0,
+                queued: 0,
+                next_id: 0,
+                admin_queue: VecDeque::new(),
+                user_queues: HashMap::new(),
+                user_order: VecDeque::new(),
+                avg_duration: 1.0,
+            }),
+        }
+    }
+
+    fn retry_after(&self, state: &AdmissionState) -> Duration {
+        let backlog = (state.queued + 1) as f64 / self.config.max_concurrent.max(1) as f64;
+        Duration::from_secs_f64((state.avg_duration * backlog).clamp(1.0, 3600.0))
+    }
+
+    fn permit(self: &Arc<Self>, memory: usize) -> AdmissionPermit {
+        AdmissionPermit {
+            controller: self.clone(),
+            memory: memory,
+            start: Instant::now(),
+        }
+    }
+
+    // Wait until the query may run; the returned permit must be held for
+    // the duration of the execution
+    pub async fn admit(
+        self: &Arc<Self>,
+        user: Arc<str>,
+        priority: Priority,
+        memory_estimate: usize,
+    ) -> Result<AdmissionPermit, Rejection> {
+        // A query larger than the memory cap may still run on its own
+        let memory = memory_estimate.min(self.config.max_memory);
+
+        let (id, rx) = {
+            let mut state = self.state.lock().unwrap();
+            let nobody_waiting = state.queued == 0;
+            if nobody_waiting && state.fits(&self.config, memory) {
+                state.running += 1;
+                state.memory += memory;
+                return Ok(self.permit(memory));
+            }
+            if state.queued >= self.config.max_queued {
+                return Err(Rejection {
+                    reason: "query queue is full",
+                    retry_after: self.retry_after(&state),
+                });
+            }
+            let (tx, rx) = oneshot::channel();
+            let id = state.next_id;
+            state.next_id += 1;
+            let waiter = Waiter {
+                id: id,
+                memory: memory,
+                grant: tx,
+            };
+            match priority {
+                Priority::Admin => state.admin_queue.push_back(waiter),
+                Priority::Regular => {
+                    if !state.user_queues.contains_key(&user) {
+                        state.user_order.push_back(user.clone());
+                    }
+                    state
+                        .user_queues
+                        .entry(user.clone())
+                        .or_default()
+                        .push_back(waiter);
+                }
+            }
+            state.queued += 1;
+            (id, rx)
+        };
+
+        // Dropping this future while it waits withdraws the waiter
+        let mut queued = Queued {
+            controller: self.clone(),
+            user: user,
+            id: id,
+            memory: memory,
+            rx: rx,
+            settled: false,
+        };
+        if let Ok(Ok(())) = tokio::time::timeout(self.config.queue_timeout, &mut queued.rx).await {
+            queued.settled = true;
+            return Ok(self.permit(memory));
+        }
+        // A waiter dispatched concurrently with the timeout may run after all
+        if queued.withdraw() {
+            return Ok(self.permit(memory));
+        }
+        Err(Rejection {
+            reason: "timed out waiting for admission",
+            retry_after: self.retry_after(&self.state.lock().unwrap()),
+        })
+    }
+
+    fn release(&self, memory: usize, duration: Duration) {
+        let mut state = self.state.lock().unwrap();
+        state.running -= 1;
+        state.memory -= memory;
+        state.avg_duration = 0.9 * state.avg_duration + 0.1 * duration.as_secs_f64();
+        self.dispatch(&mut state);
+    }
+
+    fn dispatch(&self, state: &mut AdmissionState) {
+        while let Some(waiter) = state.pop_next(&self.config) {
+            state.queued -= 1;
+            state.running += 1;
+            state.memory += waiter.memory;
+            if waiter.grant.send(()).is_err() {
+                // The waiter gave up in the meantime
+                state.running -= 1;
+                state.memory -= waiter.memory;
+            }
+        }
+    }
+
+    pub fn running(&self) -> usize {
+        self.state.lock().unwrap().running
+    }
+
+    pub fn queued(&self) -> usize {
+        self.state.lock().unwrap().queued
+    }
+}
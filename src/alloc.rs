@@ -0,0 +1,286 @@
+use datafusion::arrow::array::{make_array, ArrayData, ArrayRef, MutableArrayData};
+use datafusion::arrow::buffer::Buffer;
+use datafusion::arrow::error::ArrowError;
+use datafusion::arrow::record_batch::RecordBatch;
+use std::ptr::NonNull;
+use std::sync::atomic::{AtomicUsize, Ordering};
+use std::sync::Arc;
+
+///////////////////////////////
+// Page-backed table buffers //
+///////////////////////////////
+
+/* Cached tables can be copied into memory regions mapped directly from the
+ * kernel, one region per partition, instead of individually allocated Arrow
+ * buffers. Regions may be backed by huge pages, which cuts the TLB misses of
+ * scans over multi-GB tables:
+ * - explicit: pages from the hugetlbfs pool (MAP_HUGETLB), which must have
+ *   been reserved by the administrator (vm.nr_hugepages);
+ * - transparent: regular mappings hinted with MADV_HUGEPAGE, which the
+ *   kernel backs with huge pages when it can.
+ * Explicit huge pages fall back to transparent ones, and those to regular
+ * pages, when unavailable. Writing the region from the calling thread also
+ * places it on that thread's NUMA node (see crate::numa).
+ */
+
+const BUFFER_ALIGNMENT: usize = 64;
+const HUGE_PAGE_SIZE: usize = 2 * 1024 * 1024;
+
+#[derive(Clone, Copy, Debug, PartialEq)]
+pub enum HugePages {
+    Off,
+    Transparent,
+    Explicit,
+}
+
+impl std::str::FromStr for HugePages {
+    type Err = String;
+
+    fn from_str(s: &str) -> Result<Self, Self::Err> {
+        match s {
+            "off" => Ok(HugePages::Off),
+            "transparent" => Ok(HugePages::Transparent),
+            "explicit" => Ok(HugePages::Explicit),
+            _ => Err(format!(
+                "invalid huge page mode '{s}'; expected off, transparent or explicit"
+            )),
+        }
+    }
+}
+
+#[derive(Clone, Copy, Debug, PartialEq)]
+enum Backing {
+    HugeTlb,
+    Transparent,
+    Regular,
+}
+
+// Bytes currently held in regions of each backing
+static HUGETLB_BYTES: AtomicUsize = AtomicUsize::new(0);
+static TRANSPARENT_BYTES: AtomicUsize = AtomicUsize::new(0);
+static REGULAR_BYTES: AtomicUsize = AtomicUsize::new(0);
+
+fn counter(backing: Backing) -> &'static AtomicUsize {
+    match backing {
+        Backing::HugeTlb => &HUGETLB_BYTES,
+        Backing::Transparent => &TRANSPARENT_BYTES,
+        Backing::Regular => &REGULAR_BYTES,
+    }
+}
+
+#[derive(Clone, Copy, Debug)]
+pub struct PageStats {
+    // Bytes of table regions mapped from the hugetlbfs pool
+    pub hugetlb_bytes: usize,
+    // Bytes of table regions hinted for transparent huge pages
+    pub transparent_bytes: usize,
+    // Bytes of table regions on regular pages
+    pub regular_bytes: usize,
+    // Anonymous memory of the whole process actually backed by transparent
+    // huge pages, as reported by the kernel
+    pub anon_huge_bytes: Option<usize>,
+}
+
+fn anon_huge_bytes() -> Option<usize> {
+    let rollup = std::fs::read_to_string("/proc/self/smaps_rollup").ok()?;
+    let line = rollup
+        .lines()
+        .find(|line| line.starts_with("AnonHugePages:"))?;
+    let kb: usize = line.split_whitespace().nth(1)?.parse().ok()?;
+    Some(kb * 1024)
+}
+
+pub fn page_stats() -> PageStats {
+    PageStats {
+        hugetlb_bytes: HUGETLB_BYTES.load(Ordering::Acquire),
+        transparent_bytes: TRANSPARENT_BYTES.load(Ordering::Acquire),
+        regular_bytes: REGULAR_BYTES.load(Ordering::Acquire),
+        anon_huge_bytes: anon_huge_bytes(),
+    }
+}
+
+// Anonymous memory mapping owning the buffers copied into it
+#[derive(Debug)]
+struct Region {
+    ptr: NonNull<u8>,
+    len: usize,
+    backing: Backing,
+}
+
+// The region is only written while it is being filled, before any buffer
+// referencing it is shared
+unsafe impl Send for Region {}
+unsafe impl Sync for Region {}
+
+fn map_anonymous(len: usize, flags: libc::c_int) -> Option<NonNull<u8>> {
+    let ptr = unsafe {
+        libc::mmap(
+            std::ptr::null_mut(),
+            len,
+            libc::PROT_READ | libc::PROT_WRITE,
+            libc::MAP_PRIVATE | libc::MAP_ANONYMOUS | flags,
+            -1,
+            0,
+        )
+    };
+    if ptr == libc::MAP_FAILED {
+        None
+    } else {
+        NonNull::new(ptr as *mut u8)
+    }
+}
+
+#[cfg(target_os = "linux")]
+fn map_hugetlb(len: usize) -> Option<NonNull<u8>> {
+    map_anonymous(len, libc::MAP_HUGETLB)
+}
+
+#[cfg(not(target_os = "linux"))]
+fn map_hugetlb(_len: usize) -> Option<NonNull<u8>> {
+    None
+}
+
+#[cfg(target_os = "linux")]
+fn advise_hugepage(ptr: NonNull<u8>, len: usize) -> bool {
+    unsafe { libc::madvise(ptr.as_ptr() as *mut libc::c_void, len, libc::MADV_HUGEPAGE) == 0 }
+}
+
+#[cfg(not(target_os = "linux"))]
+fn advise_hugepage(_ptr: NonNull<u8>, _len: usize) -> bool {
+    false
+}
+
+impl Region {
+    fn new(len: usize, pages: HugePages) -> Result<Self, ArrowError> {
+        let len = len.max(BUFFER_ALIGNMENT);
+        let huge_len = (len + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+
+        let mut mapped = None;
+        if pages == HugePages::Explicit {
+            mapped = map_hugetlb(huge_len).map(|ptr| (ptr, huge_len, Backing::HugeTlb));
+        }
+        if mapped.is_none() && pages != HugePages::Off {
+            mapped = map_anonymous(huge_len, 0).map(|ptr| {
+                let backing = if advise_hugepage(ptr, huge_len) {
+                    Backing::Transparent
+                } else {
+                    Backing::Regular
+                };
+                (ptr, huge_len, backing)
+            });
+        }
+        if mapped.is_none() {
+            mapped = map_anonymous(len, 0).map(|ptr| (ptr, len, Backing::Regular));
+        }
+        let (ptr, len, backing) = mapped.ok_or_else(|| {
+            ArrowError::MemoryError(format!("failed to map {len} bytes for table data"))
+        })?;
+
+        counter(backing).fetch_add(len, Ordering::AcqRel);
+        Ok(Region {
+            ptr: ptr,
+            len: len,
+            backing: backing,
+        })
+    }
+}
+
+impl Drop for Region {
+    fn drop(&mut self) {
+        counter(self.backing).fetch_sub(self.len, Ordering::AcqRel);
+        unsafe {
+            libc::munmap(self.ptr.as_ptr() as *mut libc::c_void, self.len);
+        }
+    }
+}
+
+fn aligned(len: usize) -> usize {
+    (len + BUFFER_ALIGNMENT - 1) / BUFFER_ALIGNMENT * BUFFER_ALIGNMENT
+}
+
+// Copy an array into buffers holding exactly its (possibly sliced) values
+fn compact(array: &ArrayRef) -> ArrayData {
+    let data = array.data();
+    let mut copy = MutableArrayData::new(vec![data], false, data.len());
+    copy.extend(0, 0, data.len());
+    copy.freeze()
+}
+
+fn data_bytes(data: &ArrayData) -> usize {
+    let buffers: usize = data.buffers().iter().map(|b| aligned(b.len())).sum();
+    let nulls = data.null_buffer().map_or(0, |b| aligned(b.len()));
+    let children: usize = data.child_data().iter().map(data_bytes).sum();
+    buffers + nulls + children
+}
+
+struct RegionWriter {
+    region: Arc<Region>,
+    cursor: usize,
+}
+
+impl RegionWriter {
+    fn copy_buffer(&mut self, buffer: &Buffer) -> Buffer {
+        let bytes = buffer.as_slice();
+        assert!(self.cursor + bytes.len() <= self.region.len);
+        unsafe {
+            let dst = self.region.ptr.as_ptr().add(self.cursor);
+            std::ptr::copy_nonoverlapping(bytes.as_ptr(), dst, bytes.len());
+            self.cursor += aligned(bytes.len());
+            Buffer::from_custom_allocation(
+                NonNull::new_unchecked(dst),
+                bytes.len(),
+                self.region.clone(),
+            )
+        }
+    }
+
+    fn copy_data(&mut self, data: &ArrayData) -> ArrayData {
+        let buffers = data.buffers().iter().map(|b| self.copy_buffer(b)).collect();
+        let nulls = data.null_buffer().map(|b| self.copy_buffer(b));
+        let children = data
+            .child_data()
+            .iter()
+            .map(|c| self.copy_data(c))
+            .collect();
+        let builder = ArrayData::builder(data.data_type().clone())
+            .len(data.len())
+            .offset(data.offset())
+            .null_bit_buffer(nulls)
+            .buffers(buffers)
+            .child_data(children);
+        // The copy is bytewise identical to data, which is valid
+        unsafe { builder.build_unchecked() }
+    }
+}
+
+// Copy batches into a single new region with the given page backing. The
+// region is sized by compacting each column and dropping the copy right
+// away, then filled by compacting each column again straight into it, so
+// that no more than a column is held twice besides the batches and the
+// region
+pub fn copy_batches(
+    batches: &[RecordBatch],
+    pages: HugePages,
+) -> Result<Vec<RecordBatch>, ArrowError> {
+    let total = batches
+        .iter()
+        .flat_map(|batch| batch.columns().iter())
+        .map(|column| data_bytes(&compact(column)))
+        .sum();
+
+    let mut writer = RegionWriter {
+        region: Arc::new(Region::new(total, pages)?),
+        cursor: 0,
+    };
+    batches
+        .iter()
+        .map(|batch| {
+            let columns: Vec<ArrayRef> = batch
+                .columns()
+                .iter()
+                .map(|column| make_array(writer.copy_data(&compact(column))))
+                .collect();
+            RecordBatch::try_new(batch.schema(), columns)
+        })
+        .collect()
+}
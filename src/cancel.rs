@@ -0,0 +1,135 @@
+use futures::{Stream, StreamExt};
+use std::sync::atomic::{AtomicBool, Ordering};
+use std::sync::Arc;
+use std::time::Duration;
+use tokio::sync::Notify;
+use tokio::time::Instant;
+use tonic::Status;
+
+////////////////////////
+// Query cancellation //
+////////////////////////
+
+/* A do_get response stream ends as soon as the first of the following
+ * happens:
+ * - the client goes away, which drops the response stream;
+ * - the deadline the client sent in its grpc-timeout header passes;
+ * - the query is cancelled through its CancelToken (CANCEL_QUERY action).
+ * The execution behind a ticket fills its result buffer independently of
+ * the response streams reading it (see crate::results), so that a download
+ * that ended early can resume. It stops once the query is cancelled, once
+ * the deadline of the request that started it passes, or once no response
+ * stream has read it for a grace period, as when its client went away:
+ * dropping the execution stream stops its DataFusion operators, and the
+ * exec runtime task driving the plan stops as soon as its channel closes
+ * (see crate::runtime).
+ * A query whose execution is shared with other tickets (see
+ * crate::singleflight) keeps running until all of them have stopped.
+ */
+
+#[derive(Debug, Default)]
+struct CancelState {
+    cancelled: AtomicBool,
+    notify: Notify,
+}
+
+#[derive(Clone, Debug, Default)]
+pub struct CancelToken {
+    state: Arc<CancelState>,
+}
+
+impl CancelToken {
+    pub fn new() -> Self {
+        CancelToken::default()
+    }
+
+    pub fn cancel(&self) {
+        self.state.cancelled.store(true, Ordering::Release);
+        self.state.notify.notify_waiters();
+    }
+
+    pub fn is_cancelled(&self) -> bool {
+        self.state.cancelled.load(Ordering::Acquire)
+    }
+
+    pub async fn cancelled(&self) {
+        loop {
+            // Register interest before checking, so that a concurrent
+            // cancel cannot be missed
+            let notified = self.state.notify.notified();
+            if self.is_cancelled() {
+                return;
+            }
+            notified.await;
+        }
+    }
+}
+
+// Parse the deadline of a gRPC request from its grpc-timeout header, which
+// holds at most 8 digits followed by a unit
+pub fn grpc_deadline(headers: &tonic::metadata::MetadataMap) -> Option<Instant> {
+    let value = headers.get("grpc-timeout")?.to_str().ok()?;
+    if value.len() < 2 || value.len() > 9 {
+        return None;
+    }
+    let (amount, unit) = value.split_at(value.len() - 1);
+    let amount: u64 = amount.parse().ok()?;
+    let timeout = match unit {
+        "H" => Duration::from_secs(amount * 3600),
+        "M" => Duration::from_secs(amount * 60),
+        "S" => Duration::from_secs(amount),
+        "m" => Duration::from_millis(amount),
+        "u" => Duration::from_micros(amount),
+        "n" => Duration::from_nanos(amount),
+        _ => return None,
+    };
+    Some(Instant::now() + timeout)
+}
+
+pub async fn deadline_passed(deadline: Option<Instant>) {
+    match deadline {
+        Some(deadline) => tokio::time::sleep_until(deadline).await,
+        None => futures::future::pending().await,
+    }
+}
+
+enum Next<T> {
+    Item(Option<T>),
+    Cancelled,
+    DeadlineExceeded,
+}
+
+// End the stream with an error once the token is cancelled or the deadline
+// passes, dropping the input; guard is dropped along with the stream
+pub fn cancellable<T, S, G>(
+    input: S,
+    token: CancelToken,
+    deadline: Option<Instant>,
+    guard: G,
+) -> impl Stream<Item = Result<T, Status>> + Send
+where
+    T: Send,
+    S: Stream<Item = Result<T, Status>> + Send + Unpin,
+    G: Send,
+{
+    futures::stream::unfold(Some((input, guard)), move |state| {
+        let token = token.clone();
+        async move {
+            let (mut input, guard) = state?;
+            let next = tokio::select! {
+                item = input.next() => Next::Item(item),
+                _ = token.cancelled() => Next::Cancelled,
+                _ = deadline_passed(deadline) => Next::DeadlineExceeded,
+            };
+            match next {
+                Next::Item(Some(item)) => Some((item, Some((input, guard)))),
+                Next::Item(None) => None,
+                Next::Cancelled => Some((Err(Status::cancelled("query cancelled")), None)),
+                Next::DeadlineExceeded => Some((
+                    Err(Status::deadline_exceeded("query deadline exceeded")),
+                    None,
+                )),
+            }
+        }
+    })
+}
@@ -0,0 +1,136 @@
+use datafusion::error::{DataFusionError, Result};
+use datafusion::execution::context::{SessionState, TaskContext};
+use datafusion::execution::disk_manager::DiskManagerConfig;
+use datafusion::execution::memory_pool::{
+    FairSpillPool, MemoryConsumer, MemoryPool, MemoryReservation, UnboundedMemoryPool,
+};
+use datafusion::execution::runtime_env::{RuntimeConfig, RuntimeEnv};
+use std::sync::atomic::{AtomicUsize, Ordering};
+use std::sync::Arc;
+
+///////////////////////////////
+// Query execution resources //
+///////////////////////////////
+
+/* Memory used while executing queries (hash tables, sort buffers, ...) is
+ * reserved from a single pool shared by all queries. The pool is fair: each
+ * spillable operator may use at most an equal share of it, so that one large
+ * sort or join spills to the spill directory instead of starving, or running
+ * the process out of memory for, every other query. Each query additionally
+ * draws from the pool through a quota of its own.
+ *
+ * Cached tables are plain record batches held by the context and are not
+ * reserved from the pool, so the pool limit bounds query memory only.
+ */
+
+#[derive(Clone, Debug, Default)]
+pub struct ExecutionConfig {
+    // Total memory of all executing queries; unbounded if None
+    pub memory_limit: Option<usize>,
+    // Memory of any single executing query; unbounded if None
+    pub query_memory_limit: Option<usize>,
+    // Directory for spill files; the system temporary directory if None
+    pub spill_dir: Option<std::path::PathBuf>,
+}
+
+impl ExecutionConfig {
+    pub fn runtime_env(&self) -> Result<Arc<RuntimeEnv>> {
+        let pool: Arc<dyn MemoryPool> = match self.memory_limit {
+            Some(limit) => Arc::new(FairSpillPool::new(limit)),
+            None => Arc::new(UnboundedMemoryPool::default()),
+        };
+        let disk_manager = match &self.spill_dir {
+            Some(dir) => {
+                std::fs::create_dir_all(dir)?;
+                DiskManagerConfig::NewSpecified(vec![dir.clone()])
+            }
+            None => DiskManagerConfig::NewOs,
+        };
+        let config = RuntimeConfig::new()
+            .with_memory_pool(pool)
+            .with_disk_manager(disk_manager);
+        Ok(Arc::new(RuntimeEnv::new(config)?))
+    }
+
+    // Task context in which to execute a single query planned against state,
+    // sharing the spill directory and memory pool of the state's runtime but
+    // limited to this query's quota
+    pub fn query_task_context(&self, state: &SessionState) -> Arc<TaskContext> {
+        let shared = state.runtime_env();
+        let runtime = match self.query_memory_limit {
+            Some(limit) => Arc::new(RuntimeEnv {
+                memory_pool: Arc::new(QuotaPool::new(shared.memory_pool.clone(), limit)),
+                disk_manager: shared.disk_manager.clone(),
+                object_store_registry: shared.object_store_registry.clone(),
+            }),
+            None => shared.clone(),
+        };
+        Arc::new(TaskContext::new(
+            None,
+            state.session_id().to_string(),
+            state.config().clone(),
+            state.scalar_functions().clone(),
+            state.aggregate_functions().clone(),
+            runtime,
+        ))
+    }
+}
+
+// Memory pool view limiting the reservations of one query to a quota, while
+// reserving every byte from the shared pool as well
+#[derive(Debug)]
+struct QuotaPool {
+    shared: Arc<dyn MemoryPool>,
+    limit: usize,
+    used: AtomicUsize,
+}
+
+impl QuotaPool {
+    fn new(shared: Arc<dyn MemoryPool>, limit: usize) -> Self {
+        QuotaPool {
+            shared: shared,
+            limit: limit,
+            used: AtomicUsize::new(0),
+        }
+    }
+}
+
+impl MemoryPool for QuotaPool {
+    fn register(&self, consumer: &MemoryConsumer) {
+        self.shared.register(consumer)
+    }
+
+    fn unregister(&self, consumer: &MemoryConsumer) {
+        self.shared.unregister(consumer)
+    }
+
+    fn grow(&self, reservation: &MemoryReservation, additional: usize) {
+        self.used.fetch_add(additional, Ordering::AcqRel);
+        self.shared.grow(reservation, additional)
+    }
+
+    fn shrink(&self, reservation: &MemoryReservation, shrink: usize) {
+        self.used.fetch_sub(shrink, Ordering::AcqRel);
+        self.shared.shrink(reservation, shrink)
+    }
+
+    fn try_grow(&self, reservation: &MemoryReservation, additional: usize) -> Result<()> {
+        let used = self.used.fetch_add(additional, Ordering::AcqRel) + additional;
+        if used > self.limit {
+            self.used.fetch_sub(additional, Ordering::AcqRel);
+            return Err(DataFusionError::ResourcesExhausted(format!(
+                "failed to allocate {additional} bytes for {}: query memory limit of {} bytes reached",
+                reservation.consumer().name(),
+                self.limit
+            )));
+        }
+        self.shared.try_grow(reservation, additional).map_err(|e| {
+            self.used.fetch_sub(additional, Ordering::AcqRel);
+            e
+        })
+    }
+
+    fn reserved(&self) -> usize {
+        self.used.load(Ordering::Acquire)
+    }
+}
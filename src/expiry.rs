@@ -0,0 +1,343 @@
+use crate::store::ShardedMap;
+use std::collections::HashMap;
+use std::sync::atomic::{AtomicUsize, Ordering};
+use std::sync::Mutex;
+use std::time::{Duration, Instant};
+
+//////////////////////////////
+// Hierarchical timer wheel //
+//////////////////////////////
+
+/* A hierarchical timer wheel with LEVELS levels of SLOTS slots each. Level 0
+ * slots are one tick wide, and each slot of level l spans SLOTS^l ticks.
+ * A key is placed on the lowest level whose span covers its deadline; when
+ * the wheel reaches a higher-level slot its keys are cascaded down to finer
+ * levels. Inserting and advancing are O(1) per key, so expiring entries
+ * never requires scanning the maps they belong to.
+ *
+ * Deadlines beyond the range of the wheel are clamped to its horizon; the
+ * owner of the wheel re-checks every key handed back to it.
+ */
+
+const SLOT_BITS: u32 = 6;
+const SLOTS: usize = 1 << SLOT_BITS;
+const SLOT_MASK: u64 = (SLOTS - 1) as u64;
+const LEVELS: usize = 4;
+
+pub struct TimerWheel<K> {
+    tick: Duration,
+    origin: Instant,
+    current: u64,
+    levels: Vec<Vec<Vec<(u64, K)>>>,
+}
+
+impl<K> TimerWheel<K> {
+    pub fn new(tick: Duration) -> Self {
+        TimerWheel {
+            tick: tick,
+            origin: Instant::now(),
+            current: 0,
+            levels: (0..LEVELS)
+                .map(|_| (0..SLOTS).map(|_| vec![]).collect())
+                .collect(),
+        }
+    }
+
+    fn ticks(&self, at: Instant) -> u64 {
+        let since = at.saturating_duration_since(self.origin);
+        (since.as_nanos() / self.tick.as_nanos().max(1)) as u64
+    }
+
+    fn place(&mut self, deadline: u64, key: K) {
+        let horizon = self.current + (1 << (SLOT_BITS * LEVELS as u32)) - 1;
+        let deadline = deadline.max(self.current + 1).min(horizon);
+        let delta = deadline - self.current;
+        let level = (0..LEVELS)
+            .find(|l| delta < 1 << (SLOT_BITS * (*l as u32 + 1)))
+            .unwrap_or(LEVELS - 1);
+        let slot = ((deadline >> (SLOT_BITS * level as u32)) & SLOT_MASK) as usize;
+        self.levels[level][slot].push((deadline, key));
+    }
+
+    pub fn insert(&mut self, deadline: Instant, key: K) {
+        // Round up so that keys never fire before their deadline
+        let deadline = self.ticks(deadline) + 1;
+        self.place(deadline, key);
+    }
+
+    // Advance the wheel to now, returning the keys whose deadlines passed
+    pub fn advance(&mut self, now: Instant) -> Vec<K> {
+        let target = self.ticks(now);
+        let mut due = vec![];
+        while self.current < target {
+            self.current += 1;
+            // Cascade higher levels whose slot boundary was just reached
+            for level in 1..LEVELS {
+                let shift = SLOT_BITS * level as u32;
+                if self.current & ((1 << shift) - 1) != 0 {
+                    break;
+                }
+                let slot = ((self.current >> shift) & SLOT_MASK) as usize;
+                let cascaded = std::mem::take(&mut self.levels[level][slot]);
+                for (deadline, key) in cascaded {
+                    if deadline <= self.current {
+                        due.push(key);
+                    } else {
+                        self.place(deadline, key);
+                    }
+                }
+            }
+            let slot = (self.current & SLOT_MASK) as usize;
+            due.extend(
+                std::mem::take(&mut self.levels[0][slot])
+                    .into_iter()
+                    .map(|(_, key)| key),
+            );
+        }
+        due
+    }
+}
+
+//////////////////////////
+// Expiring bounded map //
+//////////////////////////
+
+/* Sharded map whose entries expire after a fixed time to live, or at a
+ * deadline of their own given when they are created. Deadlines are
+ * tracked by a timer wheel that a background task advances every tick, so
+ * expired entries are removed incrementally, one shard lock at a time.
+ * Lookups treat entries past their deadline as absent even before they are
+ * removed. The map enforces hard caps on its number of entries and on the
+ * estimated bytes they hold, as accounted by the caller on insertion.
+ *
+ * Each entry is scheduled in a single slot of the wheel at a time. An entry
+ * replaced, or whose time to live is extended, keeps its slot, and is
+ * scheduled again at its new deadline once the slot is reached; slots left
+ * behind by removed entries are ignored.
+ */
+
+pub const EXPIRY_TICK: Duration = Duration::from_secs(1);
+
+struct Expiring<V> {
+    value: V,
+    expires: Instant,
+    // The deadline of the slot of the wheel the entry is scheduled in
+    scheduled: Instant,
+    weight: usize,
+}
+
+#[derive(Debug)]
+pub struct CapacityError;
+
+impl std::fmt::Display for CapacityError {
+    fn fmt(&self, f: &mut std::fmt::Formatter<'_>) -> std::fmt::Result {
+        write!(f, "capacity exceeded")
+    }
+}
+
+impl std::error::Error for CapacityError {}
+
+pub struct ExpiringMap<V> {
+    map: ShardedMap<Expiring<V>>,
+    wheel: Mutex<TimerWheel<(String, Instant)>>,
+    ttl: Duration,
+    max_entries: usize,
+    max_bytes: usize,
+    entries: AtomicUsize,
+    bytes: AtomicUsize,
+}
+
+impl<V> ExpiringMap<V> {
+    pub fn new(ttl: Duration, max_entries: usize, max_bytes: usize) -> Self {
+        ExpiringMap {
+            map: ShardedMap::new(),
+            wheel: Mutex::new(TimerWheel::new(EXPIRY_TICK)),
+            ttl: ttl,
+            max_entries: max_entries,
+            max_bytes: max_bytes,
+            entries: AtomicUsize::new(0),
+            bytes: AtomicUsize::new(0),
+        }
+    }
+
+    pub fn ttl(&self) -> Duration {
+        self.ttl
+    }
+
+    fn release(&self, weight: usize) {
+        self.entries.fetch_sub(1, Ordering::AcqRel);
+        self.bytes.fetch_sub(weight, Ordering::AcqRel);
+    }
+
+    // Account for an entry of weight bytes, replacing an entry of the given
+    // weight if any, unless that would exceed the caps of the map. The entry
+    // replaced is released first, so that replacing it only counts the
+    // difference against the caps
+    fn charge(&self, replaced: Option<usize>, weight: usize) -> Result<(), CapacityError> {
+        let (added, released) = match replaced {
+            Some(replaced) => (0, replaced),
+            None => (1, 0),
+        };
+        let entries = self.entries.fetch_add(added, Ordering::AcqRel) + added;
+        let bytes = self.bytes.fetch_add(weight, Ordering::AcqRel) + weight - released;
+        if entries > self.max_entries || bytes > self.max_bytes {
+            self.entries.fetch_sub(added, Ordering::AcqRel);
+            self.bytes.fetch_sub(weight, Ordering::AcqRel);
+            return Err(CapacityError);
+        }
+        self.bytes.fetch_sub(released, Ordering::AcqRel);
+        Ok(())
+    }
+
+    // Put an entry expiring at the given deadline into the shard of its key,
+    // returning whether it must be scheduled in the wheel; a replaced entry
+    // keeps the slot it is scheduled in
+    fn put(
+        &self,
+        shard: &mut HashMap<String, Expiring<V>>,
+        key: &str,
+        value: V,
+        expires: Instant,
+        weight: usize,
+    ) -> Result<bool, CapacityError> {
+        let replaced = shard.get(key).map(|entry| (entry.weight, entry.scheduled));
+        self.charge(replaced.map(|(weight, _)| weight), weight)?;
+        let entry = Expiring {
+            value: value,
+            expires: expires,
+            scheduled: replaced.map_or(expires, |(_, scheduled)| scheduled),
+            weight: weight,
+        };
+        shard.insert(key.to_string(), entry);
+        Ok(replaced.is_none())
+    }
+
+    // Insert an entry accounting for weight bytes, replacing any entry of the
+    // same key, unless that would exceed the caps of the map
+    pub fn insert(&self, key: String, value: V, weight: usize) -> Result<(), CapacityError> {
+        let expires = Instant::now() + self.ttl;
+        let schedule = self
+            .map
+            .update(&key, |shard| self.put(shard, &key, value, expires, weight))?;
+        if schedule {
+            self.wheel.lock().unwrap().insert(expires, (key, expires));
+        }
+        Ok(())
+    }
+
+    // The value of the live entry of a key, or else of a new entry made by f,
+    // expiring at the given deadline rather than after the map's time to
+    // live, and accounting for weight bytes unless that would exceed the caps
+    // of the map
+    pub fn get_or_insert_with(
+        &self,
+        key: &str,
+        expires: Instant,
+        weight: usize,
+        f: impl FnOnce() -> V,
+    ) -> Result<V, CapacityError>
+    where
+        V: Clone,
+    {
+        let now = Instant::now();
+        let (value, schedule) = self.map.update(key, |shard| {
+            match shard.get(key) {
+                Some(entry) if entry.expires > now => return Ok((entry.value.clone(), false)),
+                _ => {}
+            }
+            let value = f();
+            let schedule = self.put(shard, key, value.clone(), expires, weight)?;
+            Ok::<_, CapacityError>((value, schedule))
+        })?;
+        if schedule {
+            self.wheel
+                .lock()
+                .unwrap()
+                .insert(expires, (key.to_string(), expires));
+        }
+        Ok(value)
+    }
+
+    // Change the weight of the entry of a key, as when what it holds grew
+    // after it was inserted. The caps are not checked, since the bytes are
+    // held already, but the new weight counts against later insertions
+    pub fn reweigh(&self, key: &str, weight: usize) {
+        self.map.update(key, |shard| {
+            if let Some(entry) = shard.get_mut(key) {
+                self.bytes.fetch_add(weight, Ordering::AcqRel);
+                self.bytes.fetch_sub(entry.weight, Ordering::AcqRel);
+                entry.weight = weight;
+            }
+        })
+    }
+
+    pub fn get_with<R>(&self, key: &str, f: impl FnOnce(&V) -> R) -> Option<R> {
+        let now = Instant::now();
+        self.map
+            .get_with(key, |entry| (entry.expires > now).then(|| f(&entry.value)))
+            .flatten()
+    }
+
+    pub fn remove(&self, key: &str) -> Option<V> {
+        let entry = self.map.remove(key)?;
+        self.release(entry.weight);
+        (entry.expires > Instant::now()).then(|| entry.value)
+    }
+
+    // Remove the entries whose deadlines have passed according to the wheel
+    pub fn expire(&self, now: Instant) -> usize {
+        let due = self.wheel.lock().unwrap().advance(now);
+        let mut removed = 0;
+        for (key, scheduled) in due {
+            // Still live entries, whose time to live was extended or whose
+            // deadline lies beyond the wheel's horizon, are scheduled again
+            let outcome = self.map.update(&key, |shard| {
+                let entry = shard.get_mut(&key)?;
+                if entry.scheduled != scheduled {
+                    return None;
+                }
+                if entry.expires <= now {
+                    return shard.remove(&key).map(Ok);
+                }
+                entry.scheduled = entry.expires;
+                Some(Err(entry.expires))
+            });
+            match outcome {
+                Some(Ok(entry)) => {
+                    self.release(entry.weight);
+                    removed += 1;
+                }
+                Some(Err(expires)) => {
+                    self.wheel.lock().unwrap().insert(expires, (key, expires));
+                }
+                None => {}
+            }
+        }
+        removed
+    }
+
+    // Sweep the whole map for expired entries
+    pub fn clear_expired(&self) -> usize {
+        let now = Instant::now();
+        let mut released = vec![];
+        let removed = self.map.retain(|_, entry| {
+            let live = entry.expires > now;
+            if !live {
+                released.push(entry.weight);
+            }
+            live
+        });
+        for weight in released {
+            self.release(weight);
+        }
+        removed
+    }
+
+    pub fn len(&self) -> usize {
+        self.entries.load(Ordering::Acquire)
+    }
+
+    pub fn bytes(&self) -> usize {
+        self.bytes.load(Ordering::Acquire)
+    }
+}
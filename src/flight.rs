@@ -1,22 +1,55 @@
+use crate::admission::{
+    AdmissionConfig, AdmissionController, AdmissionPermit, Priority, Rejection,
+};
+use crate::alloc::page_stats;
+use crate::cancel::{cancellable, deadline_passed, grpc_deadline, CancelToken};
+use crate::context::ExecutionConfig;
+use crate::expiry::{ExpiringMap, EXPIRY_TICK};
+use crate::lazy::LazyTable;
+use crate::lookup::LookupIndex;
+use crate::results::{ResultBuffer, ResultPool, ResultRange};
+use crate::runtime::{execute_on, ServiceRuntimes};
+use crate::session::{session_context, SessionTables, TempTableBudget};
+use crate::shm::{SharedExports, SharedFile};
+use crate::singleflight::{canonical_sql, SingleFlight};
+use crate::table::CachedTable;
+use crate::token::TokenKeySet;
+use crate::writeback::{PipeWriter, Pipes};
+use arrow_flight::decode::{DecodedPayload, FlightDataDecoder};
 use arrow_flight::encode::FlightDataEncoderBuilder;
 use arrow_flight::error::FlightError;
+use arrow_flight::utils::flight_data_from_arrow_batch;
 use arrow_flight::{
     flight_service_server::FlightService, Action, ActionType, Criteria, Empty, FlightData,
     FlightDescriptor, FlightEndpoint, FlightInfo, HandshakeRequest, HandshakeResponse, PutResult,
-    SchemaResult, Ticket,
+    SchemaAsIpc, SchemaResult, Ticket,
 };
-use datafusion::arrow::datatypes::Schema;
+use datafusion::arrow::datatypes::{Schema, SchemaRef};
+use datafusion::arrow::ipc::writer::IpcWriteOptions;
+use datafusion::common::{OwnedTableReference, TableReference};
+use datafusion::datasource::{source_as_provider, MemTable, TableProvider};
 use datafusion::error::DataFusionError;
+use datafusion::execution::context::TaskContext;
+use datafusion::execution::memory_pool::MemoryConsumer;
+use datafusion::logical_expr::LogicalPlan;
+use datafusion::physical_plan::{collect, execute_stream};
+use datafusion::physical_plan::stream::RecordBatchStreamAdapter;
 use datafusion::prelude::*;
+use datafusion::sql::parser::{DFParser, Statement as DFStatement};
+use datafusion::sql::sqlparser::ast::{ObjectType, Statement as SQLStatement};
+use datafusion::sql::sqlparser::dialect::GenericDialect;
+use datafusion::sql::sqlparser::parser::Parser;
 use futures::Stream;
 use futures::StreamExt;
 use futures::TryStreamExt;
 use rand::{distributions::Alphanumeric, Rng};
-use std::collections::HashMap;
+use std::collections::HashSet;
 use std::pin::Pin;
+use std::sync::atomic::{AtomicU64, Ordering};
 use std::sync::Arc;
-use std::time::{Duration, Instant};
-use tokio::sync::RwLock;
+use std::time::Duration;
+use tokio::sync::{Mutex, OnceCell, RwLock};
+use tokio::time::Instant;
 use tonic::{Request, Response, Status, Streaming};
 
 ///////////////////////////////////////////
@@ -37,10 +70,244 @@ fn dferr_to_status(dferr: DataFusionError) -> Status {
     Status::new(tonic::Code::Unknown, e.to_string())
 }
 
+fn resourceerr_to_status(dferr: DataFusionError) -> Status {
+    match dferr {
+        DataFusionError::ResourcesExhausted(e) => Status::resource_exhausted(e),
+        e => dferr_to_status(e),
+    }
+}
+
+fn flighterr_to_status(e: FlightError) -> Status {
+    match e {
+        FlightError::Tonic(status) => status,
+        e => Status::invalid_argument(e.to_string()),
+    }
+}
+
+fn arrowerr_to_status(e: datafusion::arrow::error::ArrowError) -> Status {
+    Status::internal(e.to_string())
+}
+
+fn joinerr_to_status(_e: tokio::task::JoinError) -> Status {
+    Status::internal("internal error in background task")
+}
+
 fn mderr_to_status(_e: tonic::metadata::errors::ToStrError) -> Status {
     Status::new(tonic::Code::Unknown, "error reading request header")
 }
 
+fn rejection_to_status(rejection: Rejection) -> Status {
+    let retry_after = rejection.retry_after.as_secs();
+    let mut status =
+        Status::resource_exhausted(format!("{}; retry after {retry_after}s", rejection.reason));
+    if let Ok(value) = retry_after.to_string().parse() {
+        status.metadata_mut().insert("retry-after", value);
+    }
+    status
+}
+
+// The cached table behind a provider, including a lazy table once loaded
+fn cached_table(provider: &dyn TableProvider) -> Option<&CachedTable> {
+    let any = provider.as_any();
+    any.downcast_ref::<CachedTable>().or_else(|| {
+        let lazy = any.downcast_ref::<LazyTable>()?;
+        lazy.loaded().map(|table| table.as_ref())
+    })
+}
+
+// Estimate the memory a query needs from the size of the cached tables it scans
+fn estimate_memory(plan: &LogicalPlan) -> usize {
+    let scanned = match plan {
+        LogicalPlan::TableScan(scan) => source_as_provider(&scan.source)
+            .ok()
+            .and_then(|provider| cached_table(provider.as_ref()).map(|table| table.num_bytes()))
+            .unwrap_or(0),
+        _ => 0,
+    };
+    plan.inputs()
+        .into_iter()
+        .map(estimate_memory)
+        .fold(scanned, usize::saturating_add)
+}
+
+// The name of a table of the default schema, where configured arrays are
+// registered, however qualified
+fn default_table_name(reference: &OwnedTableReference) -> Option<&str> {
+    match reference {
+        TableReference::Bare { table } => Some(table.as_ref()),
+        TableReference::Partial { schema, table } if schema == "public" => Some(table.as_ref()),
+        TableReference::Full {
+            catalog,
+            schema,
+            table,
+        } if catalog == "datafusion" && schema == "public" => Some(table.as_ref()),
+        _ => None,
+    }
+}
+
+// The load times of the cached tables a plan scans, with the names of those
+// of the default schema
+fn cached_scans(plan: &LogicalPlan) -> Vec<(Option<String>, std::time::Instant)> {
+    let mut scans: Vec<_> = plan.inputs().into_iter().flat_map(cached_scans).collect();
+    if let LogicalPlan::TableScan(scan) = plan {
+        let provider = source_as_provider(&scan.source).ok();
+        let loaded_at = provider
+            .as_ref()
+            .and_then(|provider| cached_table(provider.as_ref()).map(|table| table.loaded_at()));
+        if let Some(loaded_at) = loaded_at {
+            let name = default_table_name(&scan.table_name).map(String::from);
+            scans.push((name, loaded_at));
+        }
+    }
+    scans
+}
+
+// Tell clients how old the data of a response is, in whole seconds
+fn insert_data_age<T>(response: &mut Response<T>, loaded_at: Option<Instant>) {
+    if let Some(loaded_at) = loaded_at {
+        let age = loaded_at.elapsed().as_secs();
+        if let Ok(value) = age.to_string().parse() {
+            response
+                .metadata_mut()
+                .insert("x-rustyshim-data-age", value);
+        }
+    }
+}
+
+fn batch_bytes(batch: &RecordBatch) -> usize {
+    batch
+        .columns()
+        .iter()
+        .map(|c| c.get_array_memory_size())
+        .sum()
+}
+
+// Split the first word off a statement
+fn next_word(sql: &str) -> (&str, &str) {
+    let sql = sql.trim_start();
+    let end = sql.find(char::is_whitespace).unwrap_or(sql.len());
+    sql.split_at(end)
+}
+
+// What a statement of a session does
+enum SessionStatement<'a> {
+    // Queries, planned in the shared context or that of the session
+    Query,
+    // CREATE VIEW, DROP VIEW and DROP TABLE, applying to the session's own
+    // tables
+    Ddl,
+    // CACHE TABLE <name> [AS] <query>
+    Cache(&'a str, &'a str),
+}
+
+fn classify_statement(sql: &str) -> Result<SessionStatement, Status> {
+    // CACHE TABLE is not a statement DataFusion parses
+    let (cache, rest) = next_word(sql);
+    let (table, rest) = next_word(rest);
+    if cache.eq_ignore_ascii_case("CACHE") && table.eq_ignore_ascii_case("TABLE") {
+        let (name, rest) = next_word(rest);
+        if !valid_identifier(name) {
+            return Err(Status::invalid_argument("invalid table name"));
+        }
+        let (keyword, query) = next_word(rest);
+        let query = if keyword.eq_ignore_ascii_case("AS") {
+            query
+        } else {
+            rest
+        };
+        return Ok(SessionStatement::Cache(name, query));
+    }
+
+    // Statements that would change the shared context, or read files on
+    // the server, are refused
+    let mut statements =
+        DFParser::parse_sql(sql).map_err(|e| Status::invalid_argument(e.to_string()))?;
+    if statements.len() != 1 {
+        return Err(Status::invalid_argument("expected a single statement"));
+    }
+    match statements.pop_front() {
+        Some(DFStatement::Statement(statement)) => match *statement {
+            SQLStatement::Query(_)
+            | SQLStatement::Explain { .. }
+            | SQLStatement::ShowTables { .. }
+            | SQLStatement::ShowColumns { .. } => Ok(SessionStatement::Query),
+            SQLStatement::CreateView { .. }
+            | SQLStatement::Drop {
+                object_type: ObjectType::View | ObjectType::Table,
+                ..
+            } => Ok(SessionStatement::Ddl),
+            _ => Err(Status::permission_denied("statement not permitted")),
+        },
+        Some(DFStatement::DescribeTableStmt(_)) => Ok(SessionStatement::Query),
+        _ => Err(Status::permission_denied("statement not permitted")),
+    }
+}
+
+// Total size of the cached tables registered in a context, including the
+// lazy tables loaded so far
+async fn cached_table_bytes(ctx: &SessionContext) -> usize {
+    let mut total = 0;
+    for catalog_name in ctx.catalog_names() {
+        let Some(catalog) = ctx.catalog(&catalog_name) else {
+            continue;
+        };
+        for schema_name in catalog.schema_names() {
+            let Some(schema) = catalog.schema(&schema_name) else {
+                continue;
+            };
+            for table_name in schema.table_names() {
+                if let Some(table) = schema.table(&table_name).await {
+                    if let Some(cached) = cached_table(table.as_ref()) {
+                        total += cached.num_bytes();
+                    }
+                }
+            }
+        }
+    }
+    total
+}
+
+// Names of session tables and stored arrays
+fn valid_identifier(name: &str) -> bool {
+    name.chars().all(|c| c.is_ascii_alphanumeric() || c == '_')
+        && name.starts_with(|c: char| c.is_ascii_alphabetic() || c == '_')
+}
+
+// Split a ticket into the ticket proper and the range of its result that it
+// selects, given by ";batch=N" or ";offset=N[;limit=N]" suffixes
+fn parse_ticket(ticket: &str) -> Result<(&str, ResultRange), Status> {
+    let mut parts = ticket.split(';');
+    let ticket = parts.next().unwrap_or_default();
+    let (mut batch, mut offset, mut limit) = (None, None, None);
+    for part in parts {
+        let (name, value) = part
+            .split_once('=')
+            .ok_or(Status::invalid_argument("invalid ticket range"))?;
+        let value: usize = value
+            .parse()
+            .map_err(|_| Status::invalid_argument("invalid ticket range"))?;
+        match name {
+            "batch" => batch = Some(value),
+            "offset" => offset = Some(value),
+            "limit" => limit = Some(value),
+            _ => return Err(Status::invalid_argument("invalid ticket range")),
+        }
+    }
+    let range = match (batch, offset, limit) {
+        (Some(start), None, None) => ResultRange::Batches { start: start },
+        (None, offset, limit) => ResultRange::Rows {
+            offset: offset.unwrap_or(0),
+            limit: limit,
+        },
+        _ => {
+            return Err(Status::invalid_argument(
+                "ticket range selects both a batch and rows",
+            ))
+        }
+    };
+    Ok((ticket, range))
+}
+
 // Convert this DFSchema to Bytes, which is
 // surprisingly verbose and requires picking some IpcWriteOptions
 fn schema_to_bytes(schema: &Schema) -> bytes::Bytes {
@@ -57,7 +324,60 @@ fn schema_to_bytes(schema: &Schema) -> bytes::Bytes {
 // FlightService implementation //
 //////////////////////////////////
 
-const ITEM_EXPIRATION_AGE: Duration = Duration::from_secs(86400);
+// Service configuration
+#[derive(Clone, Debug)]
+pub struct FusionFlightConfig {
+    pub session_ttl: Duration,
+    pub ticket_ttl: Duration,
+    pub max_sessions: usize,
+    pub max_session_bytes: usize,
+    pub max_tickets: usize,
+    // Bound on the bytes held by tickets, including their results in memory
+    pub max_ticket_bytes: usize,
+    // Memory each query result, and all results together, may hold before
+    // spilling to disk
+    pub result_memory: usize,
+    pub result_memory_pool: usize,
+    // How long a query goes on executing while no client reads its result,
+    // and a key lookup exchange stays open while its client is idle
+    pub result_grace: Duration,
+    // Directory of, and bound on the total size of, result files exported to
+    // shared memory
+    pub shm_dir: std::path::PathBuf,
+    pub max_shm_bytes: usize,
+    // Bounds on the bytes held by the tables uploaded by a session, and by
+    // those of all sessions together
+    pub temp_table_quota: usize,
+    pub max_temp_table_bytes: usize,
+    // Directory of the named pipes through which admin uploads are stored
+    // by the administrator
+    pub pipe_dir: std::path::PathBuf,
+    pub admission: AdmissionConfig,
+    pub execution: ExecutionConfig,
+}
+
+impl Default for FusionFlightConfig {
+    fn default() -> Self {
+        FusionFlightConfig {
+            session_ttl: Duration::from_secs(86400),
+            ticket_ttl: Duration::from_secs(600),
+            max_sessions: 100_000,
+            max_session_bytes: 64 * 1024 * 1024,
+            max_tickets: 10_000,
+            max_ticket_bytes: 2048 * 1024 * 1024,
+            result_memory: 64 * 1024 * 1024,
+            result_memory_pool: 1024 * 1024 * 1024,
+            result_grace: Duration::from_secs(30),
+            shm_dir: std::path::PathBuf::from("/dev/shm"),
+            max_shm_bytes: 4096 * 1024 * 1024,
+            temp_table_quota: 256 * 1024 * 1024,
+            max_temp_table_bytes: 4096 * 1024 * 1024,
+            pipe_dir: std::env::temp_dir(),
+            admission: AdmissionConfig::default(),
+            execution: ExecutionConfig::default(),
+        }
+    }
+}
 
 #[derive(Clone, Copy, PartialEq)]
 pub enum SessionType {
@@ -68,22 +388,53 @@ pub enum SessionType {
 
 #[derive(Clone)]
 pub struct ClientSessionInfo {
-    username: String,
-    start: Instant,
+    // The session token, identifying the session
+    key: Arc<str>,
+    username: Arc<str>,
     session_type: SessionType,
+    // When the session token expires
+    expires: std::time::Instant,
 }
 
-// TODO:
-// - implement timeout based on creation time
-// - store token to add per-session protection
-#[derive(Clone)]
+// A ticket may be fetched any number of times until it expires: its first
+// do_get executes the query into a result buffer, from which every do_get
+// streams the range of the result it asks for (see crate::results)
 pub struct TicketInfo {
-    start: Instant,
+    username: Arc<str>,
+    query_key: String,
+    // The weight of the ticket without its result
+    weight: usize,
+    memory_estimate: usize,
     dataframe: DataFrame,
+    // When the oldest of the tables the query reads was loaded
+    loaded_at: Option<Instant>,
+    // Cancels the execution filling the result
+    token: CancelToken,
+    result: OnceCell<Arc<ResultBuffer>>,
+    // The result exported to shared memory, if requested
+    export: OnceCell<Arc<SharedFile>>,
 }
 
-type SessionMap = Arc<RwLock<HashMap<String, ClientSessionInfo>>>;
-type TicketMap = Arc<RwLock<HashMap<String, TicketInfo>>>;
+// Once a ticket has expired or been cancelled, and its last reader has gone
+// away, nobody can read its result any more
+impl Drop for TicketInfo {
+    fn drop(&mut self) {
+        self.token.cancel();
+    }
+}
+
+// Sessions and tickets expire after their configured time to live. Entry
+// weights estimate the bytes held by each entry; a ticket also pins the plan
+// and the context (and hence the tables) it was created against, and its
+// result buffer, whose bytes held in memory are added to its weight once it
+// is filled
+type SessionMap = Arc<ExpiringMap<ClientSessionInfo>>;
+type TicketMap = Arc<ExpiringMap<Arc<TicketInfo>>>;
+type TempTableMap = Arc<ExpiringMap<Arc<SessionTables>>>;
+
+fn capacity_to_status(what: &str) -> Status {
+    Status::resource_exhausted(format!("too many outstanding {what}"))
+}
 
 pub trait FusionFlightAdministrator {
     // Authentication and authorization
@@ -96,20 +447,210 @@ pub trait FusionFlightAdministrator {
 
     // (Re)create datafusion SessionContext
     fn refresh_context(&self) -> Result<SessionContext, Box<dyn std::error::Error>>;
+
+    // (Re)load the key set for signing stateless session tokens; None
+    // disables signed tokens in favor of server-side sessions
+    fn token_keys(&self) -> Result<Option<TokenKeySet>, Box<dyn std::error::Error>> {
+        Ok(None)
+    }
+
+    // Store the Arrow IPC streams written into the given pipes into an
+    // array, transformed by an expression of $input if given; blocks until
+    // the streams end and the store completes
+    fn store_array(
+        &self,
+        _array: &str,
+        _transform: Option<&str>,
+        _schema: &Schema,
+        _pipes: &[std::path::PathBuf],
+    ) -> Result<(), Box<dyn std::error::Error>> {
+        Err("storing arrays is not supported".into())
+    }
+
+    // Number of pipes store_array reads in parallel
+    fn store_fanout(&self) -> usize {
+        1
+    }
+
+    // Load a new version of a single table of the context, along with the
+    // tables derived from it, or None if the table can only be refreshed
+    // along with the whole context
+    fn reload_table(
+        &self,
+        _name: &str,
+    ) -> Result<Option<Vec<(String, Arc<dyn TableProvider>)>>, Box<dyn std::error::Error>> {
+        Ok(None)
+    }
+
+    // How long after its load a table may be read before it is reloaded in
+    // the background; None to keep it until the context is refreshed
+    fn max_staleness(&self, _name: &str) -> Option<Duration> {
+        None
+    }
+}
+
+// Stream an admin upload into an array through pipes which the
+// administrator's store reads as they are written, returning the number of
+// rows stored
+async fn write_back(
+    administrator: Arc<dyn FusionFlightAdministrator + Send + Sync + 'static>,
+    ffi: tokio::runtime::Handle,
+    pipe_dir: std::path::PathBuf,
+    array: String,
+    transform: Option<String>,
+    data: impl Stream<Item = Result<FlightData, FlightError>> + Send + 'static,
+) -> Result<usize, Status> {
+    // The schema comes first, and is needed to start the store
+    let mut decoder = FlightDataDecoder::new(data);
+    let schema = loop {
+        let decoded = decoder
+            .next()
+            .await
+            .ok_or(Status::invalid_argument("upload has no schema"))?;
+        match decoded.map_err(flighterr_to_status)?.payload {
+            DecodedPayload::Schema(schema) => break schema,
+            DecodedPayload::None => continue,
+            DecodedPayload::RecordBatch(_) => {
+                return Err(Status::invalid_argument("upload has no schema"))
+            }
+        }
+    };
+    let pipes = Pipes::new(&pipe_dir, administrator.store_fanout())
+        .map_err(|e| Status::internal(format!("error creating pipes: {e}")))?;
+    let pipes = Arc::new(pipes);
+    let mut writer = PipeWriter::new(pipes.clone(), &schema)
+        .map_err(|e| Status::internal(format!("error starting pipe writers: {e}")))?;
+    let paths = pipes.paths().to_vec();
+    let mut store = ffi.spawn_blocking(move || {
+        administrator
+            .store_array(&array, transform.as_deref(), &schema, &paths)
+            .map_err(|e| e.to_string())
+    });
+
+    // Write batches as they are decoded; should the store end first, it
+    // failed, or has read the whole upload
+    let upload = async {
+        while let Some(decoded) = decoder.next().await {
+            if let DecodedPayload::RecordBatch(batch) =
+                decoded.map_err(flighterr_to_status)?.payload
+            {
+                writer.write(batch).await.map_err(arrowerr_to_status)?;
+            }
+        }
+        writer.finish().await.map_err(arrowerr_to_status)
+    };
+    let (uploaded, stored) = tokio::select! {
+        uploaded = upload => (uploaded, None),
+        stored = &mut store => (Ok(()), Some(stored)),
+    };
+
+    // A failed upload truncates the streams, failing the store
+    writer.abort();
+    let stored = match stored {
+        Some(stored) => stored,
+        None => store.await,
+    };
+    let written = tokio::task::spawn_blocking(move || writer.close())
+        .await
+        .map_err(joinerr_to_status)?;
+    uploaded?;
+    stored
+        .map_err(joinerr_to_status)?
+        .map_err(|e| Status::unknown(e))?;
+    written.map_err(arrowerr_to_status)
 }
 
 pub struct FusionFlightService {
     ctx: Arc<RwLock<SessionContext>>,
+    ctx_generation: Arc<AtomicU64>,
+    // Serializes context refreshes and table reloads, which share the
+    // administrator's connection
+    refresh_lock: Arc<Mutex<()>>,
+    // Tables being reloaded in the background
+    reloading: Arc<std::sync::Mutex<HashSet<String>>>,
+    singleflight: Arc<SingleFlight>,
+    admission: Arc<AdmissionController>,
+    execution: ExecutionConfig,
     token_map: SessionMap,
+    token_keys: std::sync::RwLock<Option<Arc<TokenKeySet>>>,
     ticket_map: TicketMap,
+    temp_tables: TempTableMap,
+    temp_budget: Arc<TempTableBudget>,
+    pipe_dir: std::path::PathBuf,
+    results: Arc<ResultPool>,
+    result_grace: Duration,
+    exports: Arc<SharedExports>,
     flight_info: Arc<RwLock<Vec<Result<FlightInfo, Status>>>>,
-    administrator: Box<dyn FusionFlightAdministrator + Send + Sync + 'static>,
+    administrator: Arc<dyn FusionFlightAdministrator + Send + Sync + 'static>,
+    runtimes: ServiceRuntimes,
+}
+
+// Answer each batch of keys with a batch of the rows of the table matching
+// them, until the client stops sending keys or goes away. Every answer is
+// encoded as a single message, however small or large, so that answers
+// correspond one to one with batches of keys. The table is read, and its
+// index reserved, within the query memory quota of the task context
+// Index a table and answer each batch of keys streamed by the client. The
+// exchange holds its admission only while it builds its index, and ends once
+// its client neither sends keys nor reads matches for the idle period
+async fn lookup(
+    frame: DataFrame,
+    keys: Vec<String>,
+    task_ctx: Arc<TaskContext>,
+    permit: AdmissionPermit,
+    idle: Duration,
+    data: impl Stream<Item = Result<FlightData, FlightError>> + Send + 'static,
+    sender: &tokio::sync::mpsc::Sender<Result<FlightData, Status>>,
+) -> Result<(), Status> {
+    let idle_status = || Status::deadline_exceeded("lookup exchange idle for too long");
+    let schema: Schema = frame.schema().into();
+    let plan = frame.create_physical_plan().await.map_err(dferr_to_status)?;
+    let batches = collect(plan, task_ctx.clone())
+        .await
+        .map_err(resourceerr_to_status)?;
+    let mut reservation = MemoryConsumer::new("LookupIndex").register(task_ctx.memory_pool());
+    reservation
+        .try_grow(LookupIndex::estimate_size(&schema, &batches, &keys))
+        .map_err(resourceerr_to_status)?;
+    let mut index =
+        LookupIndex::try_new(Arc::new(schema), batches, &keys).map_err(dferr_to_status)?;
+    drop(permit);
+
+    let options = IpcWriteOptions::default();
+    let schema = SchemaAsIpc::new(index.schema(), &options).into();
+    let mut pending = vec![schema];
+    let mut decoder = FlightDataDecoder::new(data);
+    loop {
+        for data in pending.drain(..) {
+            match tokio::time::timeout(idle, sender.send(Ok(data))).await {
+                Ok(Ok(())) => {}
+                // The client went away
+                Ok(Err(_)) => return Ok(()),
+                Err(_) => return Err(idle_status()),
+            }
+        }
+        let decoded = match tokio::time::timeout(idle, decoder.next()).await {
+            Ok(Some(decoded)) => decoded.map_err(flighterr_to_status)?,
+            Ok(None) => return Ok(()),
+            Err(_) => return Err(idle_status()),
+        };
+        if let DecodedPayload::RecordBatch(keys) = decoded.payload {
+            let matches = index.probe(&keys).map_err(dferr_to_status)?;
+            let (dictionaries, matches) = flight_data_from_arrow_batch(&matches, &options);
+            pending.extend(dictionaries);
+            pending.push(matches);
+        }
+    }
 }
 
 impl FusionFlightService {
+    // Queries are executed on the exec runtime and administrator calls made
+    // on the blocking pool of the ffi runtime; see crate::runtime
     pub async fn new(
         ctx: SessionContext,
-        administrator: Box<dyn FusionFlightAdministrator + Send + Sync + 'static>,
+        administrator: Arc<dyn FusionFlightAdministrator + Send + Sync + 'static>,
+        config: FusionFlightConfig,
+        runtimes: ServiceRuntimes,
     ) -> Self {
         // Create default flights (for each table))
         let schema_provider = ctx
@@ -139,80 +680,571 @@ impl FusionFlightService {
 
         let collected_flight_info = futures::future::join_all(flight_info).await;
 
+        let token_keys = administrator
+            .token_keys()
+            .expect("unable to load session token keys");
+
+        let token_map = Arc::new(ExpiringMap::new(
+            config.session_ttl,
+            config.max_sessions,
+            config.max_session_bytes,
+        ));
+        let ticket_map = Arc::new(ExpiringMap::new(
+            config.ticket_ttl,
+            config.max_tickets,
+            config.max_ticket_bytes,
+        ));
+
+        // Session tables expire along with their session
+        let temp_tables = Arc::new(ExpiringMap::new(
+            config.session_ttl,
+            config.max_sessions,
+            usize::MAX,
+        ));
+
+        // Expire sessions, tickets and session tables incrementally in the
+        // background
+        let (tokens, tickets, temps) = (token_map.clone(), ticket_map.clone(), temp_tables.clone());
+        tokio::spawn(async move {
+            let mut interval = tokio::time::interval(EXPIRY_TICK);
+            loop {
+                let now = interval.tick().await.into_std();
+                tokens.expire(now);
+                tickets.expire(now);
+                temps.expire(now);
+            }
+        });
+
         // Create and return service object
         FusionFlightService {
             ctx: Arc::new(RwLock::new(ctx)),
-            token_map: Arc::new(RwLock::new(HashMap::<String, ClientSessionInfo>::new())),
-            ticket_map: Arc::new(RwLock::new(HashMap::<String, TicketInfo>::new())),
+            ctx_generation: Arc::new(AtomicU64::new(0)),
+            refresh_lock: Arc::new(Mutex::new(())),
+            reloading: Arc::new(std::sync::Mutex::new(HashSet::new())),
+            singleflight: Arc::new(SingleFlight::new()),
+            admission: Arc::new(AdmissionController::new(config.admission)),
+            results: Arc::new(ResultPool::new(
+                config.result_memory,
+                config.result_memory_pool,
+                config
+                    .execution
+                    .spill_dir
+                    .clone()
+                    .unwrap_or_else(std::env::temp_dir),
+            )),
+            result_grace: config.result_grace,
+            exports: Arc::new(SharedExports::new(config.shm_dir, config.max_shm_bytes)),
+            execution: config.execution,
+            token_map: token_map,
+            token_keys: std::sync::RwLock::new(token_keys.map(Arc::new)),
+            ticket_map: ticket_map,
+            temp_tables: temp_tables,
+            temp_budget: Arc::new(TempTableBudget::new(
+                config.temp_table_quota,
+                config.max_temp_table_bytes,
+            )),
+            pipe_dir: config.pipe_dir,
             flight_info: Arc::new(RwLock::new(collected_flight_info)),
             administrator: administrator,
+            runtimes: runtimes,
         }
     }
 
-    pub async fn create_token(&self, username: &String, session_type: SessionType) -> String {
+    pub fn create_token(
+        &self,
+        username: &String,
+        session_type: SessionType,
+    ) -> Result<String, Status> {
+        // Issue a self-contained signed token if a key set is configured
+        let token_keys = self.token_keys.read().unwrap().clone();
+        if let Some(keys) = token_keys {
+            return Ok(keys.sign(username, session_type, self.token_map.ttl()));
+        }
+
         let token: String = rand::thread_rng()
             .sample_iter(&Alphanumeric)
             .take(32)
             .map(char::from)
             .collect();
-        let mut db = self.token_map.write().await;
-        (*db)
-            .entry(token.clone())
-            .and_modify(|session| {
-                (*session).username = username.clone();
-                (*session).start = Instant::now();
-                (*session).session_type = session_type
-            })
-            .or_insert(ClientSessionInfo {
-                username: username.clone(),
-                start: Instant::now(),
-                session_type: session_type,
-            });
-        token
+        let weight = std::mem::size_of::<ClientSessionInfo>() + token.len() + username.len();
+        self.token_map
+            .insert(
+                token.clone(),
+                ClientSessionInfo {
+                    key: Arc::from(token.as_str()),
+                    username: Arc::from(username.as_str()),
+                    session_type: session_type,
+                    expires: std::time::Instant::now() + self.token_map.ttl(),
+                },
+                weight,
+            )
+            .map_err(|_| capacity_to_status("sessions"))?;
+        Ok(token)
     }
 
-    pub async fn validate_headers(
+    // Called on every RPC and never awaits: a server-side token only takes
+    // the read lock of its shard, while a signed token is decoded and its
+    // signature verified, which allocates
+    pub fn validate_headers(
         &self,
         headers: &tonic::metadata::MetadataMap,
-    ) -> Result<SessionType, Status> {
-        dbg!(headers);
+    ) -> Result<ClientSessionInfo, Status> {
         let provided_token = headers
             .get("authorization")
             .ok_or(Status::unauthenticated("no session token provided"))?
             .to_str()
             .map_err(mderr_to_status)?;
 
-        let db = self.token_map.read().await;
-        let info = (*db)
-            .get(provided_token)
-            .ok_or(Status::unauthenticated("invalid session token"))?;
-        let token_age = info.start.elapsed();
-        if token_age > ITEM_EXPIRATION_AGE {
-            return Err(Status::unauthenticated("expired session token"));
+        // Signed tokens are validated statelessly
+        if TokenKeySet::is_signed_token(provided_token) {
+            let token_keys = self.token_keys.read().unwrap().clone();
+            let claims = token_keys
+                .ok_or(Status::unauthenticated("signed session tokens not enabled"))?
+                .verify(provided_token)
+                .map_err(|e| Status::unauthenticated(e.to_string()))?;
+            let expires = std::time::Instant::now() + claims.remaining();
+            return Ok(ClientSessionInfo {
+                key: Arc::from(provided_token),
+                username: Arc::from(claims.username),
+                session_type: claims.session_type,
+                expires: expires,
+            });
         }
-        Ok(info.session_type)
+
+        self.token_map
+            .get_with(provided_token, |info| info.clone())
+            .ok_or(Status::unauthenticated("invalid or expired session token"))
     }
 
-    pub async fn create_ticket(&self, dataframe: DataFrame) -> String {
+    pub fn create_ticket(
+        &self,
+        username: Arc<str>,
+        query_key: String,
+        dataframe: DataFrame,
+    ) -> Result<String, Status> {
+        let memory_estimate = estimate_memory(dataframe.logical_plan());
+        let loaded_at = self.revalidate(dataframe.logical_plan());
         let ticket: String = rand::thread_rng()
             .sample_iter(&Alphanumeric)
             .take(32)
             .map(char::from)
             .collect();
-        let mut tdb = self.ticket_map.write().await;
-        (*tdb).insert(
-            ticket.clone(),
-            TicketInfo {
-                start: Instant::now(),
-                dataframe: dataframe,
-            },
-        );
-        ticket
+        let weight =
+            std::mem::size_of::<TicketInfo>() + ticket.len() + username.len() + query_key.len();
+        self.ticket_map
+            .insert(
+                ticket.clone(),
+                Arc::new(TicketInfo {
+                    username: username,
+                    query_key: query_key,
+                    weight: weight,
+                    memory_estimate: memory_estimate,
+                    dataframe: dataframe,
+                    loaded_at: loaded_at,
+                    token: CancelToken::new(),
+                    result: OnceCell::new(),
+                    export: OnceCell::new(),
+                }),
+                weight,
+            )
+            .map_err(|_| capacity_to_status("tickets"))?;
+        Ok(ticket)
+    }
+
+    // When the oldest of the tables a plan reads was loaded, starting a
+    // reload of each of them that has outlived its maximum staleness. The
+    // query itself is served from the tables as they are
+    fn revalidate(&self, plan: &LogicalPlan) -> Option<Instant> {
+        let scans = cached_scans(plan);
+        for (name, loaded_at) in &scans {
+            let Some(name) = name else {
+                continue;
+            };
+            let stale = self
+                .administrator
+                .max_staleness(name)
+                .map_or(false, |limit| loaded_at.elapsed() > limit);
+            if stale {
+                self.start_reload(name);
+            }
+        }
+        let oldest = scans.into_iter().map(|(_, loaded_at)| loaded_at).min()?;
+        Some(Instant::from_std(oldest))
     }
 
-    pub async fn get_ticket(&self, ticket: String) -> Option<TicketInfo> {
-        let mut tdb = self.ticket_map.write().await;
-        (*tdb).remove(&ticket)
+    // Reload a table in the background, once however many queries find it
+    // stale meanwhile, and swap it into the shared context when loaded
+    fn start_reload(&self, name: &str) {
+        if !self.reloading.lock().unwrap().insert(name.to_string()) {
+            return;
+        }
+        let name = name.to_string();
+        let ctx = self.ctx.clone();
+        let ctx_generation = self.ctx_generation.clone();
+        let refresh_lock = self.refresh_lock.clone();
+        let reloading = self.reloading.clone();
+        let administrator = self.administrator.clone();
+        let ffi = self.runtimes.ffi.clone();
+        tokio::spawn(async move {
+            let _refreshing = refresh_lock.lock().await;
+            let reload_name = name.clone();
+            let reloaded = ffi
+                .spawn_blocking(move || {
+                    administrator
+                        .reload_table(&reload_name)
+                        .map_err(|e| e.to_string())
+                })
+                .await;
+            // A failed reload is retried by the next query finding the
+            // table stale. The table and the tables derived from it are
+            // swapped in together, so that no query reads some of them old
+            // and others new
+            if let Ok(Ok(Some(tables))) = reloaded {
+                let wctx = ctx.write().await;
+                for (name, table) in tables {
+                    let _ = wctx.register_table(name.as_str(), table);
+                }
+                ctx_generation.fetch_add(1, Ordering::AcqRel);
+            }
+            reloading.lock().unwrap().remove(&name);
+        });
+    }
+
+    // Context in which to plan the queries of a session, and the part of
+    // their query keys identifying it: the shared context for sessions
+    // without tables of their own, or else the session and the version of
+    // its tables
+    async fn query_context(
+        &self,
+        session: &ClientSessionInfo,
+    ) -> Result<(SessionContext, String), Status> {
+        let rctx = self.ctx.read().await;
+        let generation = self.ctx_generation.load(Ordering::Acquire);
+        let session_tables = self
+            .temp_tables
+            .get_with(&session.key, |tables| tables.clone())
+            .filter(|tables| !tables.is_empty());
+        match session_tables {
+            Some(tables) => {
+                let version = tables.version();
+                let ctx = session_context(&rctx, tables).map_err(dferr_to_status)?;
+                Ok((ctx, format!("{generation}:{}:{version}", session.key)))
+            }
+            None => Ok((rctx.clone(), generation.to_string())),
+        }
+    }
+
+    // The tables of a session, created if need be to expire along with the
+    // session; concurrent callers all get the same tables
+    fn session_tables(&self, session: &ClientSessionInfo) -> Result<Arc<SessionTables>, Status> {
+        let weight = std::mem::size_of::<SessionTables>() + session.key.len();
+        self.temp_tables
+            .get_or_insert_with(&session.key, session.expires, weight, || {
+                Arc::new(SessionTables::new(self.temp_budget.clone()))
+            })
+            .map_err(|_| capacity_to_status("session tables"))
+    }
+
+    // Plan a statement of a session, returning its dataframe and query key.
+    // Views are created in, and tables dropped from, the session's own
+    // tables, and so are tables cached with CACHE TABLE, which executes its
+    // query right away and returns the number of rows cached
+    async fn session_sql(
+        &self,
+        session: &ClientSessionInfo,
+        query: &str,
+        deadline: Option<Instant>,
+    ) -> Result<(DataFrame, String), Status> {
+        let df = match classify_statement(query)? {
+            SessionStatement::Query => {
+                // Identical queries against the same context generation (and
+                // session tables) share a key, so that concurrent executions
+                // of them can be deduplicated
+                let (ctx, context_key) = self.query_context(session).await?;
+                let df = ctx.sql(query).await.map_err(dferr_to_status)?;
+                return Ok((df, format!("{context_key}:{}", canonical_sql(query))));
+            }
+            SessionStatement::Ddl => {
+                let tables = self.session_tables(session)?;
+                let ctx =
+                    session_context(&*self.ctx.read().await, tables).map_err(dferr_to_status)?;
+                ctx.sql(query).await.map_err(dferr_to_status)?
+            }
+            SessionStatement::Cache(name, cached) => {
+                let rows = self.cache_table(session, name, cached, deadline).await?;
+                let ctx = self.ctx.read().await.clone();
+                ctx.sql(&format!("SELECT {rows} AS cached_rows"))
+                    .await
+                    .map_err(dferr_to_status)?
+            }
+        };
+        let (_, context_key) = self.query_context(session).await?;
+        Ok((df, format!("{context_key}:{}", canonical_sql(query))))
+    }
+
+    // Execute a query of a session, under admission, into a table of the
+    // session held in memory, returning the number of rows cached
+    async fn cache_table(
+        &self,
+        session: &ClientSessionInfo,
+        name: &str,
+        query: &str,
+        deadline: Option<Instant>,
+    ) -> Result<usize, Status> {
+        if !matches!(classify_statement(query)?, SessionStatement::Query) {
+            return Err(Status::invalid_argument("only queries can be cached"));
+        }
+        let (ctx, _) = self.query_context(session).await?;
+        let df = ctx.sql(query).await.map_err(dferr_to_status)?;
+        let memory_estimate = estimate_memory(df.logical_plan());
+        let permit = self
+            .admit(session, memory_estimate, &CancelToken::new(), deadline)
+            .await?;
+
+        // Execute on the exec runtime, within the query memory quota, and
+        // within the session table quota
+        let state = self.ctx.read().await.state();
+        let task_ctx = self.execution.query_task_context(&state);
+        let schema: SchemaRef = Arc::new(df.schema().into());
+        let mut stream = execute_on(self.runtimes.exec(), schema.clone(), move || {
+            Box::pin(async move {
+                let plan = df.create_physical_plan().await?;
+                execute_stream(plan, task_ctx)
+            })
+        });
+        let (mut batches, mut rows, mut bytes) = (vec![], 0, 0);
+        loop {
+            let batch = tokio::select! {
+                batch = stream.next() => batch,
+                _ = deadline_passed(deadline) => {
+                    return Err(Status::deadline_exceeded("query deadline exceeded"))
+                }
+            };
+            let Some(batch) = batch else {
+                break;
+            };
+            let batch = batch.map_err(dferr_to_status)?;
+            rows += batch.num_rows();
+            bytes += batch_bytes(&batch);
+            if bytes > self.temp_budget.quota {
+                return Err(Status::resource_exhausted(
+                    "cached table exceeds the session table quota",
+                ));
+            }
+            batches.push(batch);
+        }
+        drop(permit);
+
+        let table = MemTable::try_new(schema, vec![batches]).map_err(dferr_to_status)?;
+        self.session_tables(session)?
+            .register(name.to_string(), Arc::new(table), bytes)
+            .map_err(resourceerr_to_status)?;
+        Ok(rows)
+    }
+
+    pub fn get_ticket(&self, ticket: &str) -> Option<Arc<TicketInfo>> {
+        self.ticket_map.get_with(ticket, |info| info.clone())
+    }
+
+    // The result of a ticket of the session, executing its query on first use
+    async fn ticket_result(
+        &self,
+        session: &ClientSessionInfo,
+        ticket: &str,
+        deadline: Option<Instant>,
+    ) -> Result<(Arc<TicketInfo>, Arc<ResultBuffer>), Status> {
+        let info = self
+            .get_ticket(ticket)
+            .ok_or(Status::not_found("ticket not found"))?;
+        if session.session_type != SessionType::Admin && info.username != session.username {
+            return Err(Status::permission_denied("ticket belongs to another user"));
+        }
+        let result = info
+            .result
+            .get_or_try_init(|| self.execute_ticket(session, ticket, &info, deadline, None))
+            .await?
+            .clone();
+        Ok((info, result))
+    }
+
+    // Wait for an execution slot for queries of the given estimated memory
+    async fn admit(
+        &self,
+        session: &ClientSessionInfo,
+        memory_estimate: usize,
+        token: &CancelToken,
+        deadline: Option<Instant>,
+    ) -> Result<AdmissionPermit, Status> {
+        let priority = match session.session_type {
+            SessionType::Admin => Priority::Admin,
+            _ => Priority::Regular,
+        };
+        let admit = self
+            .admission
+            .admit(session.username.clone(), priority, memory_estimate);
+        tokio::select! {
+            admitted = admit => admitted.map_err(rejection_to_status),
+            _ = token.cancelled() => Err(Status::cancelled("query cancelled")),
+            _ = deadline_passed(deadline) => {
+                Err(Status::deadline_exceeded("query deadline exceeded"))
+            }
+        }
+    }
+
+    // Plan the statements of a batch against one context, returning a ticket
+    // per statement, then start executing all of them at once under a
+    // single admission; identical statements share a ticket
+    async fn execute_batch(
+        &self,
+        session: &ClientSessionInfo,
+        sql: &str,
+        deadline: Option<Instant>,
+    ) -> Result<Vec<String>, Status> {
+        let statements = Parser::parse_sql(&GenericDialect {}, sql)
+            .map_err(|e| Status::invalid_argument(e.to_string()))?;
+        if statements.is_empty() {
+            return Err(Status::invalid_argument("no statements given"));
+        }
+        let mut planned: Vec<(DataFrame, String)> = vec![];
+        let mut indices = Vec::with_capacity(statements.len());
+        for statement in statements {
+            // Statements are planned in order, so that later ones can use
+            // the views created by earlier ones
+            let query = statement.to_string();
+            let (df, query_key) = self.session_sql(session, &query, deadline).await?;
+            let index = match planned.iter().position(|(_, key)| *key == query_key) {
+                Some(index) => index,
+                None => {
+                    planned.push((df, query_key));
+                    planned.len() - 1
+                }
+            };
+            indices.push(index);
+        }
+
+        // Tickets are only created once every statement has planned, and
+        // removed again if the batch fails to start, as the client never
+        // learns of them
+        let mut tickets = vec![];
+        if let Err(e) = self
+            .start_batch(session, planned, &mut tickets, deadline)
+            .await
+        {
+            for ticket in &tickets {
+                self.ticket_map.remove(ticket);
+            }
+            return Err(e);
+        }
+        Ok(indices.into_iter().map(|i| tickets[i].clone()).collect())
+    }
+
+    // Create a ticket per planned query of a batch, pushing each to tickets
+    // as it is created, and start executing them
+    async fn start_batch(
+        &self,
+        session: &ClientSessionInfo,
+        planned: Vec<(DataFrame, String)>,
+        tickets: &mut Vec<String>,
+        deadline: Option<Instant>,
+    ) -> Result<(), Status> {
+        let mut infos = Vec::with_capacity(planned.len());
+        for (df, query_key) in planned {
+            let ticket = self.create_ticket(session.username.clone(), query_key, df)?;
+            tickets.push(ticket.clone());
+            let info = self
+                .get_ticket(&ticket)
+                .ok_or(Status::not_found("ticket not found"))?;
+            infos.push(info);
+        }
+
+        // The batch holds one execution slot, for the memory of all its
+        // queries together, until the last of them completes
+        let memory_estimate = infos
+            .iter()
+            .map(|info| info.memory_estimate)
+            .fold(0, usize::saturating_add);
+        let permit = self
+            .admit(session, memory_estimate, &CancelToken::new(), deadline)
+            .await?;
+        let permit = Arc::new(permit);
+        for (ticket, info) in tickets.iter().zip(&infos) {
+            info.result
+                .get_or_try_init(|| {
+                    self.execute_ticket(session, ticket, info, deadline, Some(permit.clone()))
+                })
+                .await?;
+        }
+        Ok(())
+    }
+
+    // Start executing the query of a ticket into a new result buffer, sharing
+    // the execution of an identical in-flight query if possible
+    async fn execute_ticket(
+        &self,
+        session: &ClientSessionInfo,
+        ticket: &str,
+        info: &TicketInfo,
+        deadline: Option<Instant>,
+        batch_permit: Option<Arc<AdmissionPermit>>,
+    ) -> Result<Arc<ResultBuffer>, Status> {
+        // The executions of a batch outlive the action starting them, and
+        // are read by later requests with deadlines of their own
+        let fill_deadline = match batch_permit {
+            Some(_) => None,
+            None => deadline,
+        };
+        let stream = match self.singleflight.join(&info.query_key) {
+            Some(shared) => shared,
+            None => {
+                // Wait for an execution slot, unless the query runs in the
+                // slot of its batch
+                let permit = match batch_permit {
+                    Some(permit) => permit,
+                    None => {
+                        let permit = self
+                            .admit(session, info.memory_estimate, &info.token, deadline)
+                            .await?;
+                        Arc::new(permit)
+                    }
+                };
+
+                // Plan and execute on the exec runtime, within this query's
+                // memory quota
+                let state = self.ctx.read().await.state();
+                let task_ctx = self.execution.query_task_context(&state);
+                let schema: SchemaRef = Arc::new(info.dataframe.schema().into());
+                let dataframe = info.dataframe.clone();
+                let stream = execute_on(self.runtimes.exec(), schema.clone(), move || {
+                    Box::pin(async move {
+                        let plan = dataframe.create_physical_plan().await?;
+                        execute_stream(plan, task_ctx)
+                    })
+                });
+
+                // Hold the permit for as long as the execution runs
+                let stream = stream.map(move |batch| {
+                    let _ = &permit;
+                    batch
+                });
+                let stream = Box::pin(RecordBatchStreamAdapter::new(schema, stream));
+                self.singleflight.lead(info.query_key.clone(), stream)
+            }
+        };
+
+        // Drain the execution into the buffer at its own pace, so that slow
+        // clients do not hold on to execution resources and interrupted
+        // downloads can resume, until the deadline passes or no client has
+        // read the buffer for the grace period. The ticket is then charged
+        // with the bytes its result holds in memory
+        let buffer = Arc::new(ResultBuffer::new(stream.schema(), self.results.clone()));
+        let (filled, token, grace) = (buffer.clone(), info.token.clone(), self.result_grace);
+        let tickets = self.ticket_map.clone();
+        let (ticket, weight) = (ticket.to_string(), info.weight);
+        self.runtimes.exec().spawn(async move {
+            filled.fill(stream, token, fill_deadline, grace).await;
+            tickets.reweigh(&ticket, weight + filled.memory_bytes());
+        });
+        Ok(buffer)
     }
 }
 
@@ -230,7 +1262,7 @@ impl FlightService for FusionFlightService {
     type ListActionsStream =
         Pin<Box<dyn Stream<Item = Result<ActionType, Status>> + Send + Sync + 'static>>;
     type DoExchangeStream =
-        Pin<Box<dyn Stream<Item = Result<FlightData, Status>> + Send + Sync + 'static>>;
+        Pin<Box<dyn Stream<Item = Result<FlightData, Status>> + Send + 'static>>;
     async fn handshake(
         &self,
         _request: Request<Streaming<HandshakeRequest>>,
@@ -265,16 +1297,24 @@ impl FlightService for FusionFlightService {
             ))
         }?;
 
-        // Authenticate
-        let st = self
-            .administrator
-            .authenticate(&username, &password, request_admin);
+        // Authenticate; this connects to SciDB, so block an ffi thread
+        // rather than a gRPC worker
+        let administrator = self.administrator.clone();
+        let (username, st) = self
+            .runtimes
+            .ffi
+            .spawn_blocking(move || {
+                let st = administrator.authenticate(&username, &password, request_admin);
+                (username, st)
+            })
+            .await
+            .map_err(joinerr_to_status)?;
         if st == SessionType::Unauthenticated {
             return Err(Status::unauthenticated("authentication failed"));
         }
 
         // With a successful connection, generate token and add it to token_map
-        let token = self.create_token(&username, st).await;
+        let token = self.create_token(&username, st)?;
 
         let response = Ok(arrow_flight::HandshakeResponse {
             protocol_version: 0,
@@ -290,7 +1330,7 @@ impl FlightService for FusionFlightService {
         _request: Request<Criteria>,
     ) -> Result<Response<Self::ListFlightsStream>, Status> {
         // Authorize
-        self.validate_headers(_request.metadata()).await?;
+        self.validate_headers(_request.metadata())?;
 
         // Send response
         let flight_info = self.flight_info.read().await;
@@ -303,7 +1343,8 @@ impl FlightService for FusionFlightService {
         _request: Request<FlightDescriptor>,
     ) -> Result<Response<FlightInfo>, Status> {
         // Authorize
-        self.validate_headers(_request.metadata()).await?;
+        let session = self.validate_headers(_request.metadata())?;
+        let deadline = grpc_deadline(_request.metadata());
 
         // Note: abusing a FlightDescriptor of type PATH
         // and effectively treating it as a flight descriptor
@@ -313,12 +1354,12 @@ impl FlightService for FusionFlightService {
         let fd = _request.into_inner();
         let query = fd.path[0].clone().replace("\\\'", "'");
         // Do enough DataFusion logic to get the schema of sql output
-        let rctx = self.ctx.read().await;
-        let df = (*rctx).sql(&query).await.map_err(dferr_to_status)?;
+        let (df, query_key) = self.session_sql(&session, &query, deadline).await?;
         let schema: Schema = df.schema().into();
 
         // Store this in the TicketMap
-        let ticket = self.create_ticket(df).await;
+        let ticket = self.create_ticket(session.username, query_key, df)?;
+        let loaded_at = self.get_ticket(&ticket).and_then(|info| info.loaded_at);
 
         // Return a flight info with the ticket exactly equal to the
         // query string; this is inconsistent with the Flight standard
@@ -337,7 +1378,8 @@ impl FlightService for FusionFlightService {
             total_bytes: -1,
         };
 
-        let response = tonic::Response::new(fi);
+        let mut response = tonic::Response::new(fi);
+        insert_data_age(&mut response, loaded_at);
         Ok(response)
     }
     async fn get_schema(
@@ -345,7 +1387,7 @@ impl FlightService for FusionFlightService {
         _request: Request<FlightDescriptor>,
     ) -> Result<Response<SchemaResult>, Status> {
         // Authorize
-        self.validate_headers(_request.metadata()).await?;
+        let session = self.validate_headers(_request.metadata())?;
 
         // Note: abusing a FlightDescriptor of type PATH
         // and effectively treating it as a flight descriptor
@@ -354,10 +1396,13 @@ impl FlightService for FusionFlightService {
         // in a specific command format
         let fd = _request.into_inner();
         let query = fd.path[0].clone();
+        if !matches!(classify_statement(&query)?, SessionStatement::Query) {
+            return Err(Status::invalid_argument("only queries have a schema"));
+        }
 
         // Do enough DataFusion logic to get the schema of sql output
-        let rctx = self.ctx.read().await;
-        let df = (*rctx).sql(&query).await.map_err(dferr_to_status)?;
+        let (ctx, _) = self.query_context(&session).await?;
+        let df = ctx.sql(&query).await.map_err(dferr_to_status)?;
         let schema: Schema = df.schema().into();
         let sr = SchemaResult {
             schema: schema_to_bytes(&schema),
@@ -371,61 +1416,168 @@ impl FlightService for FusionFlightService {
         _request: Request<Ticket>,
     ) -> Result<Response<Self::DoGetStream>, Status> {
         // Authorize
-        self.validate_headers(_request.metadata()).await?;
+        let session = self.validate_headers(_request.metadata())?;
+        let deadline = grpc_deadline(_request.metadata());
 
-        // Process
+        // Process; a ticket may select a range of its result, so that an
+        // interrupted download can resume where it stopped
         let ticket = _request.into_inner().ticket.escape_ascii().to_string();
-        let df = self
-            .get_ticket(ticket)
-            .await
-            .ok_or(Status::not_found("ticket not found"))?;
-        let dfstream = df
-            .dataframe
-            .execute_stream()
-            .await
-            .map_err(dferr_to_status)?;
+        let (ticket, range) = parse_ticket(&ticket)?;
+
+        // The first do_get of a ticket executes its query, later ones read
+        // the result it produces
+        let (info, result) = self.ticket_result(&session, ticket, deadline).await?;
 
         // Build a stream of `Result<FlightData>` (e.g. to return for do_get)
         let flight_data_stream = FlightDataEncoderBuilder::new()
-            .build(dfstream.map_err(dferr_to_flighterr))
-            .map_err(|e| Status::new(tonic::Code::Unknown, e.to_string()))
-            .boxed();
+            .build(result.read(range).map_err(dferr_to_flighterr))
+            .map_err(|e| Status::new(tonic::Code::Unknown, e.to_string()));
+
+        // Stop on cancellation or once the client's deadline passes; the
+        // ticket is kept alive while its result is being read
+        let token = info.token.clone();
+        let loaded_at = info.loaded_at;
+        let flight_data_stream = cancellable(flight_data_stream, token, deadline, info).boxed();
 
         // Create a tonic `Response` that can be returned from a Flight server
-        let response = tonic::Response::new(flight_data_stream);
+        let mut response = tonic::Response::new(flight_data_stream);
+        insert_data_age(&mut response, loaded_at);
         Ok(response)
     }
     async fn do_put(
         &self,
         _request: Request<Streaming<FlightData>>,
     ) -> Result<Response<Self::DoPutStream>, Status> {
-        Err(Status::unauthenticated(
-            "PUT not authorized for this database",
-        ))
+        // Authorize
+        let session = self.validate_headers(_request.metadata())?;
+
+        // The descriptor of the first message names the session table, or
+        // for admins the array to store the upload into as scidb/<array>
+        let mut stream = _request.into_inner();
+        let first = stream
+            .message()
+            .await?
+            .ok_or(Status::invalid_argument("no data uploaded"))?;
+        let descriptor = first.flight_descriptor.clone().unwrap_or_default();
+        let name = descriptor
+            .path
+            .last()
+            .cloned()
+            .ok_or(Status::invalid_argument(
+                "upload must name a table in its path",
+            ))?;
+        if !valid_identifier(&name) {
+            return Err(Status::invalid_argument("invalid table name"));
+        }
+        let data = futures::stream::once(async { Ok(first) })
+            .chain(stream)
+            .map_err(FlightError::Tonic);
+
+        if descriptor.path.len() == 2 && descriptor.path[0] == "scidb" {
+            if session.session_type != SessionType::Admin {
+                return Err(Status::permission_denied(
+                    "permission to store arrays denied",
+                ));
+            }
+            // The command of the descriptor, if any, transforms the upload
+            // before it is stored
+            let transform = (!descriptor.cmd.is_empty())
+                .then(|| String::from_utf8(descriptor.cmd.to_vec()))
+                .transpose()
+                .map_err(|_| Status::invalid_argument("invalid transform"))?;
+            let stored = self.runtimes.exec().spawn(write_back(
+                self.administrator.clone(),
+                self.runtimes.ffi.clone(),
+                self.pipe_dir.clone(),
+                name.clone(),
+                transform,
+                data,
+            ));
+            let rows = stored.await.map_err(joinerr_to_status)??;
+            let result = PutResult {
+                app_metadata: bytes::Bytes::from(format!("STORED {rows} ROWS INTO {name}")),
+            };
+            let response = futures::stream::iter(vec![Ok(result)]);
+            return Ok(tonic::Response::new(Box::pin(response)));
+        }
+        if descriptor.path.len() != 1 {
+            return Err(Status::invalid_argument("invalid upload path"));
+        }
+
+        // Decode the upload, keeping the decoded batches as they are
+        let mut decoder = FlightDataDecoder::new(data);
+        let (mut schema, mut batches, mut rows, mut bytes) = (None, vec![], 0, 0);
+        while let Some(decoded) = decoder.next().await {
+            match decoded.map_err(flighterr_to_status)?.payload {
+                DecodedPayload::Schema(decoded) => schema = Some(decoded),
+                DecodedPayload::RecordBatch(batch) => {
+                    rows += batch.num_rows();
+                    bytes += batch_bytes(&batch);
+                    if bytes > self.temp_budget.quota {
+                        return Err(Status::resource_exhausted(
+                            "upload exceeds the session table quota",
+                        ));
+                    }
+                    batches.push(batch);
+                }
+                DecodedPayload::None => {}
+            }
+        }
+        let schema = schema.ok_or(Status::invalid_argument("upload has no schema"))?;
+        let table = MemTable::try_new(schema, vec![batches]).map_err(dferr_to_status)?;
+
+        // Register the table with the session, refreshing the time to live
+        // of the session's tables
+        self.session_tables(&session)?
+            .register(name, Arc::new(table), bytes)
+            .map_err(resourceerr_to_status)?;
+
+        let result = PutResult {
+            app_metadata: bytes::Bytes::from(format!("STORED {rows} ROWS")),
+        };
+        let response = futures::stream::iter(vec![Ok(result)]);
+        Ok(tonic::Response::new(Box::pin(response)))
     }
     async fn do_action(
         &self,
         _request: Request<Action>,
     ) -> Result<Response<Self::DoActionStream>, Status> {
-        // Authorize
-        let auth = self.validate_headers(_request.metadata()).await?;
-        if auth != SessionType::Admin {
+        // Authorize; only actions on their own queries are available to
+        // regular sessions
+        let auth = self.validate_headers(_request.metadata())?;
+        let deadline = grpc_deadline(_request.metadata());
+        let is_admin = auth.session_type == SessionType::Admin;
+        let action = _request.into_inner();
+        let actiontype = action.r#type;
+        let session_action = matches!(
+            actiontype.as_str(),
+            "CANCEL_QUERY" | "EXPORT_RESULT" | "DROP_TEMP_TABLE" | "EXECUTE_BATCH"
+        );
+        if !is_admin && !session_action {
             return Err(Status::permission_denied(
                 "permission to perform admin action denied",
             ));
         }
 
         // Perform action
-        let action = _request.into_inner();
-        let actiontype = action.r#type;
         match actiontype.as_str() {
             "REFRESH_CONTEXT" => {
-                let mut wctx = self.ctx.write().await;
+                // Queries go on against the current context while the new
+                // one loads; refreshes and table reloads never use the
+                // administrator's SciDB connection concurrently
+                let _refreshing = self.refresh_lock.lock().await;
+                let administrator = self.administrator.clone();
                 let new_ctx = self
-                    .administrator
-                    .refresh_context()
+                    .runtimes
+                    .ffi
+                    .spawn_blocking(move || {
+                        administrator.refresh_context().map_err(|e| e.to_string())
+                    })
+                    .await
+                    .map_err(joinerr_to_status)?
                     .map_err(|_e| Status::internal("internal error refreshing context"))?;
-                *wctx = new_ctx;
+                *self.ctx.write().await = new_ctx;
+                self.ctx_generation.fetch_add(1, Ordering::AcqRel);
                 let result = arrow_flight::Result {
                     body: bytes::Bytes::from("SUCCESS"),
                 };
@@ -433,26 +1585,170 @@ impl FlightService for FusionFlightService {
                 Ok(tonic::Response::new(Box::pin(response)))
             }
             "CLEAR_EXPIRED_ITEMS" => {
-                let mut tokdb = self.token_map.write().await;
-                let mut tikdb = self.ticket_map.write().await;
-                let tokcount = tokdb.len();
-                let tikcount = tikdb.len();
-                (*tokdb).retain(|_, v| v.start.elapsed() < ITEM_EXPIRATION_AGE);
-                (*tikdb).retain(|_, v| v.start.elapsed() < ITEM_EXPIRATION_AGE);
+                let tokdiff = self.token_map.clear_expired();
+                let tikdiff = self.ticket_map.clear_expired();
                 let result = arrow_flight::Result {
                     body: bytes::Bytes::from("SUCCESS"),
                 };
-                let tokdiff = tokcount - tokdb.len();
                 let tokprune = arrow_flight::Result {
                     body: bytes::Bytes::from(format!("REMOVED {tokdiff} EXPIRED SESSION TOKENS")),
                 };
-                let tikdiff = tikcount - tikdb.len();
                 let tikprune = arrow_flight::Result {
                     body: bytes::Bytes::from(format!("REMOVED {tikdiff} EXPIRED TICKETS")),
                 };
                 let response = futures::stream::iter(vec![Ok(result), Ok(tokprune), Ok(tikprune)]);
                 Ok(tonic::Response::new(Box::pin(response)))
             }
+            "RELOAD_TOKEN_KEYS" => {
+                let token_keys = self.administrator.token_keys().map_err(|_e| {
+                    Status::internal("internal error reloading session token keys")
+                })?;
+                *self.token_keys.write().unwrap() = token_keys.map(Arc::new);
+                let result = arrow_flight::Result {
+                    body: bytes::Bytes::from("SUCCESS"),
+                };
+                let response = futures::stream::iter(vec![Ok(result)]);
+                Ok(tonic::Response::new(Box::pin(response)))
+            }
+            "MEMORY_USAGE" => {
+                let rctx = self.ctx.read().await;
+                let reserved = rctx.runtime_env().memory_pool.reserved();
+                let cached = cached_table_bytes(&rctx).await;
+                drop(rctx);
+                let limit = match self.execution.memory_limit {
+                    Some(limit) => format!("{limit} BYTES"),
+                    None => String::from("UNLIMITED"),
+                };
+                let pages = page_stats();
+                let mut lines = vec![
+                    String::from("SUCCESS"),
+                    format!("QUERY MEMORY RESERVED {reserved} BYTES"),
+                    format!("QUERY MEMORY LIMIT {limit}"),
+                    format!("CACHED TABLE MEMORY {cached} BYTES"),
+                    format!(
+                        "QUERY RESULT MEMORY {} OF {} BYTES",
+                        self.results.memory_bytes(),
+                        self.results.limit()
+                    ),
+                    format!(
+                        "SPILLED QUERY RESULTS {} BYTES",
+                        self.results.spilled_bytes()
+                    ),
+                    format!("EXPORTED QUERY RESULTS {} BYTES", self.exports.bytes()),
+                    format!("SESSION TABLE MEMORY {} BYTES", self.temp_budget.bytes()),
+                    format!("HUGETLB TABLE MEMORY {} BYTES", pages.hugetlb_bytes),
+                    format!("THP-ADVISED TABLE MEMORY {} BYTES", pages.transparent_bytes),
+                    format!("REGULAR-PAGE TABLE MEMORY {} BYTES", pages.regular_bytes),
+                ];
+                if let Some(bytes) = pages.anon_huge_bytes {
+                    lines.push(format!("THP-BACKED PROCESS MEMORY {bytes} BYTES"));
+                }
+                let results = lines.into_iter().map(|line| {
+                    Ok(arrow_flight::Result {
+                        body: bytes::Bytes::from(line),
+                    })
+                });
+                let response = futures::stream::iter(results.collect::<Vec<_>>());
+                Ok(tonic::Response::new(Box::pin(response)))
+            }
+            "CANCEL_QUERY" => {
+                // Regular sessions may only cancel their own queries
+                let ticket = action.body.escape_ascii().to_string();
+                let (ticket, _) = parse_ticket(&ticket)?;
+                let info = self
+                    .get_ticket(ticket)
+                    .ok_or(Status::not_found("query not found"))?;
+                if !is_admin && info.username != auth.username {
+                    return Err(Status::permission_denied("query belongs to another user"));
+                }
+                self.ticket_map.remove(ticket);
+                info.token.cancel();
+                let outcome = match info.result.get() {
+                    None => "CANCELLED PENDING QUERY",
+                    Some(result) if result.is_complete() => "RELEASED QUERY RESULT",
+                    Some(_) => "CANCELLED RUNNING QUERY",
+                };
+                let result = arrow_flight::Result {
+                    body: bytes::Bytes::from("SUCCESS"),
+                };
+                let detail = arrow_flight::Result {
+                    body: bytes::Bytes::from(outcome),
+                };
+                let response = futures::stream::iter(vec![Ok(result), Ok(detail)]);
+                Ok(tonic::Response::new(Box::pin(response)))
+            }
+            "EXPORT_RESULT" => {
+                // Write the whole result into a shared-memory file, once per
+                // ticket, on the exec runtime
+                let ticket = action.body.escape_ascii().to_string();
+                let (ticket, _) = parse_ticket(&ticket)?;
+                let (info, result) = self.ticket_result(&auth, ticket, deadline).await?;
+                let export = info.export.get_or_try_init(|| async {
+                    let (exports, key) = (self.exports.clone(), info.query_key.clone());
+                    let stream = result.read(ResultRange::Rows {
+                        offset: 0,
+                        limit: None,
+                    });
+                    let mut task = self
+                        .runtimes
+                        .exec()
+                        .spawn(async move { exports.export(&key, stream).await });
+                    tokio::select! {
+                        exported = &mut task => {
+                            exported.map_err(joinerr_to_status)?.map_err(resourceerr_to_status)
+                        }
+                        _ = info.token.cancelled() => {
+                            task.abort();
+                            Err(Status::cancelled("query cancelled"))
+                        }
+                        _ = deadline_passed(deadline) => {
+                            task.abort();
+                            Err(Status::deadline_exceeded("query deadline exceeded"))
+                        }
+                    }
+                });
+                let export = export.await?;
+                let lines = vec![
+                    String::from("SUCCESS"),
+                    export.path.to_string_lossy().to_string(),
+                    format!("ROWS {}", export.rows),
+                    format!("BYTES {}", export.bytes),
+                ];
+                let results = lines.into_iter().map(|line| {
+                    Ok(arrow_flight::Result {
+                        body: bytes::Bytes::from(line),
+                    })
+                });
+                let response = futures::stream::iter(results.collect::<Vec<_>>());
+                Ok(tonic::Response::new(Box::pin(response)))
+            }
+            "DROP_TEMP_TABLE" => {
+                // Drop a table uploaded by the session, named in the body
+                let name = action.body.escape_ascii().to_string();
+                self.temp_tables
+                    .get_with(&auth.key, |tables| tables.deregister(&name))
+                    .flatten()
+                    .ok_or(Status::not_found("session table not found"))?;
+                let result = arrow_flight::Result {
+                    body: bytes::Bytes::from("SUCCESS"),
+                };
+                let response = futures::stream::iter(vec![Ok(result)]);
+                Ok(tonic::Response::new(Box::pin(response)))
+            }
+            "EXECUTE_BATCH" => {
+                // The body holds SQL statements separated by semicolons
+                let sql = String::from_utf8(action.body.to_vec())
+                    .map_err(|_| Status::invalid_argument("invalid statements"))?;
+                let tickets = self.execute_batch(&auth, &sql, deadline).await?;
+                let lines = std::iter::once(String::from("SUCCESS")).chain(tickets);
+                let results = lines.map(|line| {
+                    Ok(arrow_flight::Result {
+                        body: bytes::Bytes::from(line),
+                    })
+                });
+                let response = futures::stream::iter(results.collect::<Vec<_>>());
+                Ok(tonic::Response::new(Box::pin(response)))
+            }
             _ => Err(Status::invalid_argument("invalid action")),
         }
     }
@@ -462,14 +1758,44 @@ impl FlightService for FusionFlightService {
         _request: Request<Empty>,
     ) -> Result<Response<Self::ListActionsStream>, Status> {
         // Authorize
-        let auth = self.validate_headers(_request.metadata()).await?;
-        if auth != SessionType::Admin {
-            return Err(Status::permission_denied(
-                "permission to perform admin action denied",
-            ));
+        let auth = self.validate_headers(_request.metadata())?;
+
+        // Return list of actions available to the session
+        let cancel_query = arrow_flight::ActionType {
+            r#type: String::from("CANCEL_QUERY"),
+            description: String::from(
+                "Cancel the query with the ticket given in the body, or release its result",
+            ),
+        };
+        let export_result = arrow_flight::ActionType {
+            r#type: String::from("EXPORT_RESULT"),
+            description: String::from(
+                "Export the result of the query with the ticket given in the body into a shared-memory Arrow IPC file, returning its path",
+            ),
+        };
+        let drop_temp_table = arrow_flight::ActionType {
+            r#type: String::from("DROP_TEMP_TABLE"),
+            description: String::from(
+                "Drop the table uploaded by the session with the name given in the body",
+            ),
+        };
+        let execute_batch = arrow_flight::ActionType {
+            r#type: String::from("EXECUTE_BATCH"),
+            description: String::from(
+                "Plan the SQL statements in the body, separated by semicolons, and start executing them under one admission, returning a ticket per statement",
+            ),
+        };
+        if auth.session_type != SessionType::Admin {
+            let actions = vec![
+                Ok(cancel_query),
+                Ok(export_result),
+                Ok(drop_temp_table),
+                Ok(execute_batch),
+            ];
+            let response = futures::stream::iter(actions);
+            return Ok(tonic::Response::new(Box::pin(response)));
         }
 
-        // Return list of actions
         let refresh_context = arrow_flight::ActionType {
             r#type: String::from("REFRESH_CONTEXT"),
             description: String::from("Re-generate the tables by querying SciDB"),
@@ -477,11 +1803,34 @@ impl FlightService for FusionFlightService {
         let clear_expired_items = arrow_flight::ActionType {
             r#type: String::from("CLEAR_EXPIRED_ITEMS"),
             description: format!(
-                "Clear all sessions and tokens greater than {ITEM_EXPIRATION_AGE:?} secs old",
+                "Clear all sessions and tickets older than {:?} and {:?} respectively",
+                self.token_map.ttl(),
+                self.ticket_map.ttl()
             ),
         };
 
-        let actions = vec![Ok(refresh_context), Ok(clear_expired_items)];
+        let reload_token_keys = arrow_flight::ActionType {
+            r#type: String::from("RELOAD_TOKEN_KEYS"),
+            description: String::from("Reload the key set for signed session tokens"),
+        };
+
+        let memory_usage = arrow_flight::ActionType {
+            r#type: String::from("MEMORY_USAGE"),
+            description: String::from(
+                "Report the memory reserved by executing queries and held by cached tables and query results",
+            ),
+        };
+
+        let actions = vec![
+            Ok(refresh_context),
+            Ok(clear_expired_items),
+            Ok(reload_token_keys),
+            Ok(memory_usage),
+            Ok(cancel_query),
+            Ok(export_result),
+            Ok(drop_temp_table),
+            Ok(execute_batch),
+        ];
         let response = futures::stream::iter(actions);
         Ok(tonic::Response::new(Box::pin(response)))
     }
@@ -489,6 +1838,63 @@ impl FlightService for FusionFlightService {
         &self,
         _request: Request<Streaming<FlightData>>,
     ) -> Result<Response<Self::DoExchangeStream>, Status> {
-        Err(Status::unimplemented("Not yet implemented"))
+        // Authorize
+        let session = self.validate_headers(_request.metadata())?;
+        let deadline = grpc_deadline(_request.metadata());
+
+        // The descriptor of the first message names the table to look rows
+        // up in, followed by its key columns
+        let mut stream = _request.into_inner();
+        let first = stream
+            .message()
+            .await?
+            .ok_or(Status::invalid_argument("no keys sent"))?;
+        let descriptor = first.flight_descriptor.clone().unwrap_or_default();
+        let (table, keys) = match descriptor.path.split_first() {
+            Some((table, keys)) if !keys.is_empty() => (table.clone(), keys.to_vec()),
+            _ => {
+                return Err(Status::invalid_argument(
+                    "lookup must name a table and its key columns in its path",
+                ))
+            }
+        };
+        let (ctx, _) = self.query_context(&session).await?;
+        let frame = ctx
+            .table(table.as_str())
+            .await
+            .map_err(|_| Status::not_found("table not found"))?;
+        let data = futures::stream::once(async { Ok(first) })
+            .chain(stream)
+            .map_err(FlightError::Tonic);
+
+        // Indexing reads the whole table, so an exchange is admitted like a
+        // query of it until its index is built
+        let memory_estimate = estimate_memory(frame.logical_plan());
+        let permit = self
+            .admit(&session, memory_estimate, &CancelToken::new(), deadline)
+            .await?;
+        let task_ctx = self.execution.query_task_context(&ctx.state());
+
+        // Index the table and answer each batch of keys on the exec runtime,
+        // while the client streams further keys, until the deadline of the
+        // exchange passes
+        let (sender, receiver) = tokio::sync::mpsc::channel(2);
+        let idle = self.result_grace;
+        self.runtimes.exec().spawn(async move {
+            let result = tokio::select! {
+                result = lookup(frame, keys, task_ctx, permit, idle, data, &sender) => result,
+                _ = deadline_passed(deadline) => {
+                    Err(Status::deadline_exceeded("lookup deadline exceeded"))
+                }
+            };
+            if let Err(e) = result {
+                let _ = tokio::time::timeout(idle, sender.send(Err(e))).await;
+            }
+        });
+        let flight_data_stream = futures::stream::unfold(receiver, |mut receiver| async move {
+            receiver.recv().await.map(|data| (data, receiver))
+        })
+        .boxed();
+        Ok(tonic::Response::new(flight_data_stream))
     }
 }
@@ -0,0 +1,133 @@
+use crate::table::{CachedTable, TableLayout};
+use datafusion::arrow::compute::{cast, concat_batches};
+use datafusion::arrow::datatypes::SchemaRef;
+use datafusion::arrow::record_batch::RecordBatch;
+use datafusion::datasource::TableProvider;
+use datafusion::error::{DataFusionError, Result};
+use datafusion::execution::context::SessionState;
+use datafusion::logical_expr::TableType;
+use datafusion::physical_plan::{ExecutionPlan, Statistics};
+use datafusion::prelude::Expr;
+use std::any::Any;
+use std::sync::Arc;
+use tokio::runtime::Handle;
+use tokio::sync::OnceCell;
+
+/////////////////
+// Lazy tables //
+/////////////////
+
+/* A table whose schema is known up front, but whose data is only loaded on
+ * its first scan, into a cached table that serves that scan and all later
+ * ones. Loads call into SciDB, so they run on the ffi runtime; concurrent
+ * first scans wait for the same load, and a failed load is attempted again
+ * by the next scan. The loaded batches are cast to the declared schema.
+ */
+
+pub type Loader = Arc<dyn Fn() -> Result<Vec<RecordBatch>> + Send + Sync>;
+
+pub struct LazyTable {
+    schema: SchemaRef,
+    loader: Loader,
+    shared_scan: bool,
+    layout: TableLayout,
+    ffi: Handle,
+    table: OnceCell<Arc<CachedTable>>,
+}
+
+impl LazyTable {
+    pub fn new(
+        schema: SchemaRef,
+        loader: Loader,
+        shared_scan: bool,
+        layout: TableLayout,
+        ffi: Handle,
+    ) -> Self {
+        LazyTable {
+            schema: schema,
+            loader: loader,
+            shared_scan: shared_scan,
+            layout: layout,
+            ffi: ffi,
+            table: OnceCell::new(),
+        }
+    }
+
+    // The loaded table, if it has been scanned yet
+    pub fn loaded(&self) -> Option<&Arc<CachedTable>> {
+        self.table.get()
+    }
+
+    async fn load(&self) -> Result<&Arc<CachedTable>> {
+        self.table
+            .get_or_try_init(|| async {
+                let loader = self.loader.clone();
+                let batches = self
+                    .ffi
+                    .spawn_blocking(move || loader())
+                    .await
+                    .map_err(|e| DataFusionError::Execution(e.to_string()))??;
+                let batches = batches
+                    .iter()
+                    .map(|batch| self.conform(batch))
+                    .collect::<Result<Vec<_>>>()?;
+                let data = concat_batches(&self.schema, &batches)?;
+                Ok(Arc::new(CachedTable::new(
+                    data,
+                    self.shared_scan,
+                    &self.layout,
+                )?))
+            })
+            .await
+    }
+
+    fn conform(&self, batch: &RecordBatch) -> Result<RecordBatch> {
+        if batch.num_columns() != self.schema.fields().len() {
+            return Err(DataFusionError::Execution(format!(
+                "loaded {} columns instead of {}",
+                batch.num_columns(),
+                self.schema.fields().len()
+            )));
+        }
+        let columns = self
+            .schema
+            .fields()
+            .iter()
+            .zip(batch.columns())
+            .map(|(field, column)| cast(column, field.data_type()))
+            .collect::<std::result::Result<Vec<_>, _>>()?;
+        Ok(RecordBatch::try_new(self.schema.clone(), columns)?)
+    }
+}
+
+#[tonic::async_trait]
+impl TableProvider for LazyTable {
+    fn as_any(&self) -> &dyn Any {
+        self
+    }
+
+    fn schema(&self) -> SchemaRef {
+        self.schema.clone()
+    }
+
+    fn table_type(&self) -> TableType {
+        TableType::Base
+    }
+
+    async fn scan(
+        &self,
+        state: &SessionState,
+        projection: Option<&Vec<usize>>,
+        filters: &[Expr],
+        limit: Option<usize>,
+    ) -> Result<Arc<dyn ExecutionPlan>> {
+        self.load()
+            .await?
+            .scan(state, projection, filters, limit)
+            .await
+    }
+
+    fn statistics(&self) -> Option<Statistics> {
+        self.loaded().and_then(|table| table.statistics())
+    }
+}
@@ -1,2 +1,20 @@
+pub mod admission;
+pub mod alloc;
+pub mod cancel;
+pub mod context;
+pub mod expiry;
 pub mod flight;
+pub mod lazy;
+pub mod lookup;
+pub mod numa;
+pub mod results;
+pub mod runtime;
 pub mod scidb;
+pub mod session;
+pub mod shm;
+pub mod singleflight;
+pub mod store;
+pub mod table;
+pub mod token;
+pub mod views;
+pub mod writeback;
@@ -0,0 +1,186 @@
+use datafusion::arrow::array::{Array, ArrayRef};
+use datafusion::arrow::compute::{cast, interleave};
+use datafusion::arrow::datatypes::{DataType, Schema, SchemaRef};
+use datafusion::arrow::record_batch::RecordBatch;
+use datafusion::arrow::row::{RowConverter, SortField};
+use datafusion::error::{DataFusionError, Result};
+use std::collections::HashMap;
+
+/////////////////
+// Key lookups //
+/////////////////
+
+/* Clients probing a table by key many times over, as feature-serving
+ * pipelines do, can stream batches of keys through do_exchange instead of
+ * planning a query per batch. The rows of the table are indexed once per
+ * exchange by their key columns, converted to the row format of arrow so
+ * that keys of several columns, of any types, hash and compare as bytes;
+ * each batch of keys is then answered with one batch of the matching rows,
+ * gathered from the table's batches without concatenating them first.
+ *
+ * Matches are returned in the order of the keys, and for each key in the
+ * order of the table. Keys holding a null match nothing, as in a join.
+ */
+
+// Marks the end of a chain of rows sharing a key
+const NO_ROW: u32 = u32::MAX;
+
+struct IndexedRow {
+    batch: u32,
+    row: u32,
+    // The next row with the same key
+    next: u32,
+}
+
+pub struct LookupIndex {
+    schema: SchemaRef,
+    batches: Vec<RecordBatch>,
+    key_types: Vec<DataType>,
+    converter: RowConverter,
+    // First and last of the rows of each key
+    keys: HashMap<Box<[u8]>, (u32, u32)>,
+    rows: Vec<IndexedRow>,
+}
+
+fn has_null(columns: &[ArrayRef], row: usize) -> bool {
+    columns.iter().any(|column| column.is_null(row))
+}
+
+impl LookupIndex {
+    // Index the batches of a table by the given key columns
+    pub fn try_new(schema: SchemaRef, batches: Vec<RecordBatch>, keys: &[String]) -> Result<Self> {
+        if keys.is_empty() {
+            return Err(DataFusionError::Plan("no key columns given".to_string()));
+        }
+        let key_columns = keys
+            .iter()
+            .map(|key| schema.index_of(key))
+            .collect::<std::result::Result<Vec<_>, _>>()?;
+        let key_types: Vec<DataType> = key_columns
+            .iter()
+            .map(|&c| schema.field(c).data_type().clone())
+            .collect();
+        let fields = key_types.iter().cloned().map(SortField::new).collect();
+        let mut index = LookupIndex {
+            schema: schema,
+            batches: vec![],
+            key_types: key_types,
+            converter: RowConverter::new(fields)?,
+            keys: HashMap::new(),
+            rows: vec![],
+        };
+
+        for (b, batch) in batches.iter().enumerate() {
+            let columns: Vec<ArrayRef> = key_columns
+                .iter()
+                .map(|&c| batch.column(c).clone())
+                .collect();
+            let keys = index.converter.convert_columns(&columns)?;
+            for r in 0..batch.num_rows() {
+                if has_null(&columns, r) {
+                    continue;
+                }
+                if index.rows.len() >= NO_ROW as usize {
+                    return Err(DataFusionError::ResourcesExhausted(
+                        "table too large to index".to_string(),
+                    ));
+                }
+                let indexed = index.rows.len() as u32;
+                index.rows.push(IndexedRow {
+                    batch: b as u32,
+                    row: r as u32,
+                    next: NO_ROW,
+                });
+                let key = keys.row(r);
+                match index.keys.get_mut(key.as_ref()) {
+                    Some((_, last)) => {
+                        index.rows[*last as usize].next = indexed;
+                        *last = indexed;
+                    }
+                    None => {
+                        index.keys.insert(key.as_ref().into(), (indexed, indexed));
+                    }
+                }
+            }
+        }
+        index.batches = batches;
+        Ok(index)
+    }
+
+    // Memory an index of the batches allocates: for each of their rows an
+    // entry in a chain and, at most, a key converted to rows and a hash entry
+    // of its own. The batches themselves share the buffers of the table they
+    // were scanned from, and are not counted
+    pub fn estimate_size(schema: &Schema, batches: &[RecordBatch], keys: &[String]) -> usize {
+        let key_columns: Vec<usize> = keys
+            .iter()
+            .filter_map(|key| schema.index_of(key).ok())
+            .collect();
+        let per_row = std::mem::size_of::<IndexedRow>()
+            + std::mem::size_of::<(Box<[u8]>, (u32, u32))>();
+        batches
+            .iter()
+            .map(|batch| {
+                let keys: usize = key_columns
+                    .iter()
+                    .map(|&c| batch.column(c).get_array_memory_size())
+                    .sum();
+                keys + batch.num_rows() * per_row
+            })
+            .sum()
+    }
+
+    pub fn schema(&self) -> &Schema {
+        &self.schema
+    }
+
+    // The rows matching a batch of keys, whose columns are the key columns in
+    // order, cast to their types if need be
+    pub fn probe(&mut self, keys: &RecordBatch) -> Result<RecordBatch> {
+        if keys.num_columns() != self.key_types.len() {
+            return Err(DataFusionError::Plan(format!(
+                "expected {} key columns, got {}",
+                self.key_types.len(),
+                keys.num_columns()
+            )));
+        }
+        let columns = keys
+            .columns()
+            .iter()
+            .zip(&self.key_types)
+            .map(|(column, key_type)| cast(column, key_type))
+            .collect::<std::result::Result<Vec<_>, _>>()?;
+        let converted = self.converter.convert_columns(&columns)?;
+
+        let mut matches = vec![];
+        for r in 0..keys.num_rows() {
+            if has_null(&columns, r) {
+                continue;
+            }
+            let Some(&(first, _)) = self.keys.get(converted.row(r).as_ref()) else {
+                continue;
+            };
+            let mut next = first;
+            while next != NO_ROW {
+                let indexed = &self.rows[next as usize];
+                matches.push((indexed.batch as usize, indexed.row as usize));
+                next = indexed.next;
+            }
+        }
+        if matches.is_empty() {
+            return Ok(RecordBatch::new_empty(self.schema.clone()));
+        }
+
+        let columns = (0..self.schema.fields().len())
+            .map(|c| {
+                let arrays: Vec<&dyn Array> = self
+                    .batches
+                    .iter()
+                    .map(|batch| batch.column(c).as_ref())
+                    .collect();
+                interleave(&arrays, &matches)
+            })
+            .collect::<std::result::Result<Vec<_>, _>>()?;
+        Ok(RecordBatch::try_new(self.schema.clone(), columns)?)
+    }
+}
@@ -1,13 +1,33 @@
 use arrow_flight::flight_service_server::FlightServiceServer;
 use clap::Parser;
+use datafusion::arrow::datatypes::Schema;
+use datafusion::catalog::schema::{MemorySchemaProvider, SchemaProvider};
+use datafusion::datasource::TableProvider;
+use datafusion::error::DataFusionError;
+use datafusion::execution::runtime_env::RuntimeEnv;
 use datafusion::prelude::*;
-use rustyshim::flight::{FusionFlightAdministrator, FusionFlightService, SessionType};
-use rustyshim::scidb::SciDBConnection;
+use rustyshim::admission::AdmissionConfig;
+use rustyshim::alloc::HugePages;
+use rustyshim::context::ExecutionConfig;
+use rustyshim::flight::{
+    FusionFlightAdministrator, FusionFlightConfig, FusionFlightService, SessionType,
+};
+use rustyshim::lazy::{LazyTable, Loader};
+use rustyshim::numa::NumaPlacement;
+use rustyshim::runtime::{RuntimeConfig, Runtimes, ServiceRuntimes};
+use rustyshim::scidb::{appended_query, SciDBConnection};
+use rustyshim::table::TableLayout;
+use rustyshim::token::TokenKeySet;
+use rustyshim::views::{
+    materialize_views, rematerialize_dependents, Materialized, ViewDefinition,
+};
 use serde::{Deserialize, Serialize};
 use serde_yaml;
 use std::io::Write;
-use std::time::Instant;
-use tokio; // 0.3.5
+use std::os::unix::fs::FileTypeExt;
+use std::sync::{Arc, Mutex};
+use std::time::{Duration, Instant};
+use tokio_stream::wrappers::UnixListenerStream;
 use tonic::transport::Server;
 
 //////////////////////////
@@ -15,15 +35,42 @@ use tonic::transport::Server;
 //////////////////////////
 
 // Configuration file format
-#[derive(Serialize, Deserialize, Debug)]
+#[derive(Serialize, Deserialize, Clone, Debug)]
 struct SciDBArray {
     name: String,
     afl: String,
+    #[serde(default)]
+    shared_scan: bool,
+    // Dimension along which the array only grows
+    #[serde(default)]
+    append_on: Option<String>,
+    // Whether to trust that the cells up to the watermark never change,
+    // rather than have SciDB checksum them on every refresh
+    #[serde(default)]
+    trust_appends: bool,
+    // Seconds after its load past which a query reading the array starts
+    // reloading it in the background
+    #[serde(default)]
+    max_staleness: Option<u64>,
+}
+
+// Discovery of the arrays of SciDB namespaces, all of them if none are given
+#[derive(Serialize, Deserialize, Debug)]
+struct Discovery {
+    #[serde(default)]
+    namespaces: Vec<String>,
+    #[serde(default)]
+    shared_scan: bool,
 }
 
 #[derive(Serialize, Deserialize, Debug)]
 struct ShimConfig {
+    #[serde(default)]
     arrays: Vec<SciDBArray>,
+    #[serde(default)]
+    views: Vec<ViewDefinition>,
+    #[serde(default)]
+    discover: Option<Discovery>,
 }
 
 // Command line arguments
@@ -54,15 +101,333 @@ struct Args {
     /// The path to the YAML config file to read
     #[arg(short, long)]
     config: std::path::PathBuf,
+
+    /// The path to a YAML key file enabling signed session tokens
+    #[arg(long)]
+    token_keys: Option<std::path::PathBuf>,
+
+    /// Seconds after which client sessions expire
+    #[arg(long, default_value_t = 86400)]
+    session_ttl: u64,
+
+    /// Seconds after which tickets and their results expire
+    #[arg(long, default_value_t = 600)]
+    ticket_ttl: u64,
+
+    /// Maximum number of concurrent client sessions
+    #[arg(long, default_value_t = 100000)]
+    max_sessions: usize,
+
+    /// Maximum number of outstanding tickets
+    #[arg(long, default_value_t = 10000)]
+    max_tickets: usize,
+
+    /// Memory outstanding tickets may hold, including their results, in MiB
+    #[arg(long, default_value_t = 2048)]
+    max_ticket_memory: usize,
+
+    /// Memory each query result may hold before spilling to disk, in MiB
+    #[arg(long, default_value_t = 64)]
+    result_memory: usize,
+
+    /// Memory all query results together may hold before spilling to disk, in MiB
+    #[arg(long, default_value_t = 1024)]
+    result_memory_pool: usize,
+
+    /// Seconds a query goes on executing while no client reads its result, and a key lookup
+    /// stays open while its client is idle
+    #[arg(long, default_value_t = 30)]
+    result_grace: u64,
+
+    /// Directory in which query results are exported for local clients to map
+    #[arg(long, default_value = "/dev/shm")]
+    shm_dir: std::path::PathBuf,
+
+    /// Maximum total size of query results exported for local clients, in MiB
+    #[arg(long, default_value_t = 4096)]
+    max_shm_size: usize,
+
+    /// Memory the tables uploaded by any single session may hold, in MiB
+    #[arg(long, default_value_t = 256)]
+    temp_table_quota: usize,
+
+    /// Memory the tables uploaded by all sessions together may hold, in MiB
+    #[arg(long, default_value_t = 4096)]
+    max_temp_table_memory: usize,
+
+    /// Maximum number of concurrently executing queries [default: number of cores]
+    #[arg(long)]
+    max_concurrent_queries: Option<usize>,
+
+    /// Maximum estimated memory of concurrently executing queries, in MiB
+    #[arg(long)]
+    max_query_memory: Option<usize>,
+
+    /// Maximum number of queries waiting for admission
+    #[arg(long, default_value_t = 1000)]
+    max_queued_queries: usize,
+
+    /// Seconds a query may wait for admission before being rejected
+    #[arg(long, default_value_t = 30)]
+    admission_timeout: u64,
+
+    /// Memory shared by all executing queries before they spill to disk, in MiB [default: unlimited]
+    #[arg(long)]
+    memory_pool: Option<usize>,
+
+    /// Memory available to any single executing query, in MiB [default: unlimited]
+    #[arg(long)]
+    query_memory_quota: Option<usize>,
+
+    /// Directory in which queries spill to disk [default: system temporary directory]
+    #[arg(long)]
+    spill_dir: Option<std::path::PathBuf>,
+
+    /// Number of threads serving gRPC requests
+    #[arg(long, default_value_t = 2)]
+    io_threads: usize,
+
+    /// Number of threads executing queries [default: number of cores]
+    #[arg(long)]
+    exec_threads: Option<usize>,
+
+    /// Maximum number of threads making concurrent calls to SciDB
+    #[arg(long, default_value_t = 4)]
+    ffi_threads: usize,
+
+    /// Flag to pin gRPC and query execution threads to separate cores
+    #[arg(long, action)]
+    pin_threads: bool,
+
+    /// Flag to place cached tables and their scans on NUMA nodes
+    #[arg(long, action)]
+    numa: bool,
+
+    /// Page backing of cached table data: off, transparent or explicit
+    #[arg(long, default_value = "off")]
+    huge_pages: HugePages,
+
+    /// The path of a Unix domain socket on which to also serve co-located clients
+    #[arg(long)]
+    unix_socket: Option<std::path::PathBuf>,
+
+    /// Directory of the named pipes through which uploads are stored into SciDB [default: system temporary directory]
+    #[arg(long)]
+    pipe_dir: Option<std::path::PathBuf>,
+
+    /// Comma-separated SciDB instances on this host reading uploads in parallel [default: the coordinator only]
+    #[arg(long, value_delimiter = ',')]
+    store_instances: Vec<i64>,
 }
 
 // Authenticator class //
 #[derive(Clone)]
 struct SciDBAdministrator {
     conn: SciDBConnection,
+    // Connection on which uploads are stored, one at a time
+    store_conn: Arc<Mutex<SciDBConnection>>,
+    store_instances: Vec<i64>,
+    // Connection on which discovered arrays are loaded, one at a time
+    load_conn: Arc<Mutex<SciDBConnection>>,
     hostname: String,
     port: i32,
     config_path: std::path::PathBuf,
+    token_keys_path: Option<std::path::PathBuf>,
+    runtime: Arc<RuntimeEnv>,
+    placement: Option<Arc<NumaPlacement>>,
+    huge_pages: HugePages,
+    runtimes: ServiceRuntimes,
+    // Tables of the last refresh, from which the next one maintains views
+    materialized: Arc<Mutex<Materialized>>,
+    // Arrays and views of the configuration read by the last refresh
+    arrays: Arc<Mutex<Vec<SciDBArray>>>,
+    views: Arc<Mutex<Vec<ViewDefinition>>>,
+}
+
+impl SciDBAdministrator {
+    fn layout(&self, ctx: &SessionContext) -> TableLayout {
+        TableLayout {
+            target_partitions: ctx.copied_config().target_partitions(),
+            placement: self.placement.clone(),
+            huge_pages: self.huge_pages,
+        }
+    }
+
+    // Run an array's query and register its result as a DataFusion table
+    fn load_array(
+        &self,
+        ctx: &SessionContext,
+        layout: &TableLayout,
+        arr: &SciDBArray,
+        previous: &Materialized,
+        current: &mut Materialized,
+    ) -> Result<(), Box<dyn std::error::Error>> {
+        let q_start = Instant::now();
+
+        // Fetch only the cells past the watermark of an array growing
+        // along a dimension, unless cells up to it have changed
+        if let Some(dimension) = &arr.append_on {
+            let loaded = previous.watermark(&arr.name, &arr.afl, dimension);
+            let table = previous.table(&arr.name);
+            if let (Some((watermark, checksum)), Some(table)) = (loaded, table) {
+                let dimensions = self.conn.query_dimensions(&arr.afl)?;
+                let unchanged = arr.trust_appends
+                    || checksum
+                        == Some(self.conn.execute_cell_checksum(
+                            &arr.afl,
+                            &dimensions,
+                            &table.schema(),
+                            dimension,
+                            watermark,
+                        )?);
+                if unchanged {
+                    let query = appended_query(&arr.afl, &dimensions, dimension, watermark);
+                    let aio = self.conn.execute_aio_query(&query)?;
+                    println!(
+                        "Executed SciDB query {}.{}",
+                        aio.qid.coordinatorid, aio.qid.queryid
+                    );
+                    println!("Elapsed SciDB query duration: {:?}", q_start.elapsed());
+                    let data = aio.to_batches()?;
+                    current.append_array(
+                        ctx,
+                        &arr.name,
+                        data,
+                        arr.shared_scan,
+                        layout,
+                        previous,
+                    )?;
+                    return self.record_checksum(arr, &dimensions, dimension, current);
+                }
+                println!(
+                    "Reloading {}: cells up to {} {} changed since loaded",
+                    arr.name, dimension, watermark
+                );
+            }
+        }
+
+        let aio = self.conn.execute_aio_query(&arr.afl)?;
+        println!(
+            "Executed SciDB query {}.{}",
+            aio.qid.coordinatorid, aio.qid.queryid
+        );
+        let q_duration = q_start.elapsed();
+        println!("Elapsed SciDB query duration: {:?}", q_duration);
+        // at this point data is still on-disk in buffer file
+        let data = aio.to_batches()?; // consumes buffer file, data lives in memory
+                                      // todo: should check that array length is > 0
+        let record_batch =
+            datafusion::arrow::compute::concat_batches(&data[0].schema(), &data).unwrap();
+        current.register_array(
+            ctx,
+            &arr.name,
+            &arr.afl,
+            arr.append_on.as_deref(),
+            record_batch,
+            arr.shared_scan,
+            layout,
+            previous,
+        )?;
+        match &arr.append_on {
+            Some(dimension) if !arr.trust_appends => {
+                let dimensions = self.conn.query_dimensions(&arr.afl)?;
+                self.record_checksum(arr, &dimensions, dimension, current)
+            }
+            _ => Ok(()),
+        }
+    }
+
+    // Have SciDB checksum the cells of an array growing along a dimension up
+    // to the watermark just loaded, for the next refresh to check, unless
+    // the array trusts its appends
+    fn record_checksum(
+        &self,
+        arr: &SciDBArray,
+        dimensions: &[String],
+        dimension: &str,
+        current: &mut Materialized,
+    ) -> Result<(), Box<dyn std::error::Error>> {
+        if arr.trust_appends {
+            return Ok(());
+        }
+        let (Some(watermark), Some(table)) =
+            (current.loaded_watermark(&arr.name), current.table(&arr.name))
+        else {
+            return Ok(());
+        };
+        let checksum = self.conn.execute_cell_checksum(
+            &arr.afl,
+            dimensions,
+            &table.schema(),
+            dimension,
+            watermark,
+        )?;
+        current.set_checksum(&arr.name, checksum);
+        Ok(())
+    }
+
+    // Register the arrays of SciDB namespaces, not already configured, as
+    // tables of the schema named after their namespace, whose data is only
+    // loaded once they are first queried
+    fn discover(
+        &self,
+        ctx: &SessionContext,
+        layout: &TableLayout,
+        discovery: &Discovery,
+    ) -> Result<usize, Box<dyn std::error::Error>> {
+        let catalog = ctx
+            .catalog("datafusion")
+            .ok_or("catalog 'datafusion' must exist")?;
+        let namespaces = match discovery.namespaces.is_empty() {
+            true => self.conn.list_namespaces()?,
+            false => discovery.namespaces.clone(),
+        };
+        let mut discovered = 0;
+        for namespace in namespaces {
+            let schema: Arc<dyn SchemaProvider> = match catalog.schema(&namespace) {
+                Some(schema) => schema,
+                None => {
+                    let schema = Arc::new(MemorySchemaProvider::new());
+                    catalog.register_schema(&namespace, schema.clone())?;
+                    schema
+                }
+            };
+            for array in self.conn.list_arrays(&namespace)? {
+                // Arrays with attributes of types Arrow lacks are left out
+                let table_schema = match array.arrow_schema() {
+                    Some(table_schema) => table_schema,
+                    None => continue,
+                };
+                if schema.table_exist(&array.name) {
+                    continue;
+                }
+                let conn = self.load_conn.clone();
+                let afl = array.afl();
+                let loader: Loader = Arc::new(move || {
+                    let conn = conn.lock().unwrap();
+                    let aio = conn
+                        .execute_aio_query(&afl)
+                        .map_err(|e| DataFusionError::External(Box::new(e)))?;
+                    println!(
+                        "Executed SciDB query {}.{}",
+                        aio.qid.coordinatorid, aio.qid.queryid
+                    );
+                    aio.to_batches()
+                        .map_err(|e| DataFusionError::External(Box::new(e)))
+                });
+                let table = LazyTable::new(
+                    Arc::new(table_schema),
+                    loader,
+                    discovery.shared_scan,
+                    layout.clone(),
+                    self.runtimes.ffi.clone(),
+                );
+                schema.register_table(array.name.clone(), Arc::new(table))?;
+                discovered += 1;
+            }
+        }
+        Ok(discovered)
+    }
 }
 
 #[tonic::async_trait]
@@ -90,39 +455,146 @@ impl FusionFlightAdministrator for SciDBAdministrator {
     // Admin actions
     fn refresh_context(&self) -> Result<SessionContext, Box<dyn std::error::Error>> {
         let db_start = Instant::now();
-        let ctx = SessionContext::new();
+        let ctx = SessionContext::with_config_rt(SessionConfig::new(), self.runtime.clone());
+        let layout = self.layout(&ctx);
 
         // Read config
         let conff = std::fs::File::open(&self.config_path)?;
         let config: ShimConfig = serde_yaml::from_reader(conff)?;
 
         // Run queries and register as DataFusion tables
-        for arr in config.arrays {
-            let q_start = Instant::now();
-            let aio = self.conn.execute_aio_query(&arr.afl)?;
+        let previous = self.materialized.lock().unwrap().clone();
+        let mut current = Materialized::default();
+        for arr in &config.arrays {
+            self.load_array(&ctx, &layout, arr, &previous, &mut current)?;
+        }
+
+        // Materialize views over the arrays, in parallel on the execution
+        // runtimes
+        if !config.views.is_empty() {
+            let v_start = Instant::now();
+            let materialize = materialize_views(
+                &ctx,
+                &config.views,
+                &layout,
+                &self.runtimes,
+                &previous,
+                &mut current,
+            );
+            let maintained = self.runtimes.exec[0].block_on(materialize)?;
             println!(
-                "Executed SciDB query {}.{}",
-                aio.qid.coordinatorid, aio.qid.queryid
+                "Maintained {} of {} views incrementally",
+                maintained,
+                config.views.len()
             );
-            let q_duration = q_start.elapsed();
-            println!("Elapsed SciDB query duration: {:?}", q_duration);
-            // at this point data is still on-disk in buffer file
-            let data = aio.to_batches()?; // consumes buffer file, data lives in memory
-                                          // todo: should check that array length is > 0
-            let record_batch =
-                datafusion::arrow::compute::concat_batches(&data[0].schema(), &data).unwrap();
-            ctx.register_batch(&arr.name, record_batch).unwrap();
+            println!(
+                "Elapsed view materialization duration: {:?}",
+                v_start.elapsed()
+            );
+        }
+
+        // Expose the other arrays of SciDB, loading them on first use
+        if let Some(discovery) = &config.discover {
+            let d_start = Instant::now();
+            let discovered = self.discover(&ctx, &layout, discovery)?;
+            println!("Discovered {} arrays", discovered);
+            println!("Elapsed discovery duration: {:?}", d_start.elapsed());
         }
+        *self.materialized.lock().unwrap() = current.settle();
+        *self.arrays.lock().unwrap() = config.arrays;
+        *self.views.lock().unwrap() = config.views;
         let db_duration = db_start.elapsed();
         println!("Elapsed database construction duration: {:?}", db_duration);
         Ok(ctx)
     }
+
+    fn reload_table(
+        &self,
+        name: &str,
+    ) -> Result<Option<Vec<(String, Arc<dyn TableProvider>)>>, Box<dyn std::error::Error>> {
+        let arrays = self.arrays.lock().unwrap().clone();
+        let arr = match arrays.iter().find(|arr| arr.name == name) {
+            Some(arr) => arr,
+            None => return Ok(None),
+        };
+        let views = self.views.lock().unwrap().clone();
+        let ctx = SessionContext::with_config_rt(SessionConfig::new(), self.runtime.clone());
+        let layout = self.layout(&ctx);
+        let previous = self.materialized.lock().unwrap().clone();
+        let mut current = previous.reopen(&ctx)?;
+        self.load_array(&ctx, &layout, arr, &previous, &mut current)?;
+
+        // Views reading the array would otherwise keep serving its previous
+        // rows, and be maintained from the wrong rows by the next refresh
+        let mut reloaded = vec![name.to_string()];
+        if !views.is_empty() {
+            let rematerialize = rematerialize_dependents(
+                &ctx,
+                &views,
+                name,
+                &layout,
+                &self.runtimes,
+                &previous,
+                &mut current,
+            );
+            reloaded.extend(self.runtimes.exec[0].block_on(rematerialize)?);
+        }
+        let tables = reloaded
+            .into_iter()
+            .filter_map(|name| {
+                let table = current.table(&name)?;
+                Some((name, table as Arc<dyn TableProvider>))
+            })
+            .collect();
+        *self.materialized.lock().unwrap() = current.settle();
+        Ok(Some(tables))
+    }
+
+    fn max_staleness(&self, name: &str) -> Option<Duration> {
+        let arrays = self.arrays.lock().unwrap();
+        let arr = arrays.iter().find(|arr| arr.name == name)?;
+        arr.max_staleness.map(Duration::from_secs)
+    }
+
+    fn token_keys(&self) -> Result<Option<TokenKeySet>, Box<dyn std::error::Error>> {
+        match &self.token_keys_path {
+            Some(path) => Ok(Some(TokenKeySet::from_file(path)?)),
+            None => Ok(None),
+        }
+    }
+
+    fn store_array(
+        &self,
+        array: &str,
+        transform: Option<&str>,
+        schema: &Schema,
+        pipes: &[std::path::PathBuf],
+    ) -> Result<(), Box<dyn std::error::Error>> {
+        let q_start = Instant::now();
+        let conn = self.store_conn.lock().unwrap();
+        let qid = conn.execute_aio_store(
+            array,
+            transform,
+            schema.fields().len(),
+            pipes,
+            &self.store_instances,
+        )?;
+        println!(
+            "Executed SciDB store {}.{} into {}",
+            qid.coordinatorid, qid.queryid, array
+        );
+        println!("Elapsed SciDB store duration: {:?}", q_start.elapsed());
+        Ok(())
+    }
+
+    fn store_fanout(&self) -> usize {
+        self.store_instances.len().max(1)
+    }
 }
 
 // Main function //
 
-#[tokio::main]
-async fn main() -> Result<(), Box<dyn std::error::Error>> {
+fn main() -> Result<(), Box<dyn std::error::Error>> {
     // Parse CLI arguments and read YAML config
     let args = Args::parse();
     // Logic:
@@ -160,15 +632,47 @@ async fn main() -> Result<(), Box<dyn std::error::Error>> {
         }
     };
 
+    // Create separate runtimes for gRPC, query execution and SciDB calls
+    let runtimes = Runtimes::new(&RuntimeConfig {
+        io_threads: args.io_threads,
+        exec_threads: args
+            .exec_threads
+            .unwrap_or(RuntimeConfig::default().exec_threads),
+        ffi_threads: args.ffi_threads,
+        pin_threads: args.pin_threads,
+        numa: args.numa,
+    })?;
+
     // Connect to SciDB...
     let conn = SciDBConnection::new(&args.hostname, &username, &password, args.port, true)?;
+    let store_conn = SciDBConnection::new(&args.hostname, &username, &password, args.port, true)?;
+    let load_conn = SciDBConnection::new(&args.hostname, &username, &password, args.port, true)?;
+
+    // Create the query execution runtime, shared across context refreshes
+    let execution = ExecutionConfig {
+        memory_limit: args.memory_pool.map(|mib| mib * 1024 * 1024),
+        query_memory_limit: args.query_memory_quota.map(|mib| mib * 1024 * 1024),
+        spill_dir: args.spill_dir,
+    };
+    let runtime = execution.runtime_env()?;
 
     // Create SciDBAdministrator //
     let admin = SciDBAdministrator {
         conn: conn,
+        store_conn: Arc::new(Mutex::new(store_conn)),
+        store_instances: args.store_instances,
+        load_conn: Arc::new(Mutex::new(load_conn)),
         hostname: args.hostname,
         port: args.port,
         config_path: args.config,
+        token_keys_path: args.token_keys,
+        runtime: runtime,
+        placement: runtimes.placement.clone(),
+        huge_pages: args.huge_pages,
+        runtimes: runtimes.handles(),
+        materialized: Arc::new(Mutex::new(Materialized::default())),
+        arrays: Arc::new(Mutex::new(vec![])),
+        views: Arc::new(Mutex::new(vec![])),
     };
 
     // Create an initial DataFusion context
@@ -176,8 +680,61 @@ async fn main() -> Result<(), Box<dyn std::error::Error>> {
 
     // Launch Flight server //
     let addr = "127.0.0.1:50051".parse()?;
-    let service = FusionFlightService::new(ctx, Box::new(admin)).await;
-    let svc = FlightServiceServer::new(service);
-    Server::builder().add_service(svc).serve(addr).await?;
+    let default_admission = AdmissionConfig::default();
+    let admission = AdmissionConfig {
+        max_concurrent: args
+            .max_concurrent_queries
+            .unwrap_or(default_admission.max_concurrent),
+        max_memory: args
+            .max_query_memory
+            .map_or(default_admission.max_memory, |mib| mib * 1024 * 1024),
+        max_queued: args.max_queued_queries,
+        queue_timeout: Duration::from_secs(args.admission_timeout),
+    };
+    let config = FusionFlightConfig {
+        session_ttl: Duration::from_secs(args.session_ttl),
+        ticket_ttl: Duration::from_secs(args.ticket_ttl),
+        max_sessions: args.max_sessions,
+        max_tickets: args.max_tickets,
+        max_ticket_bytes: args.max_ticket_memory * 1024 * 1024,
+        result_memory: args.result_memory * 1024 * 1024,
+        result_memory_pool: args.result_memory_pool * 1024 * 1024,
+        result_grace: Duration::from_secs(args.result_grace),
+        shm_dir: args.shm_dir,
+        max_shm_bytes: args.max_shm_size * 1024 * 1024,
+        temp_table_quota: args.temp_table_quota * 1024 * 1024,
+        max_temp_table_bytes: args.max_temp_table_memory * 1024 * 1024,
+        pipe_dir: args.pipe_dir.unwrap_or_else(std::env::temp_dir),
+        admission: admission,
+        execution: execution,
+        ..Default::default()
+    };
+    let handles = runtimes.handles();
+    let unix_socket = args.unix_socket;
+    runtimes.io.block_on(async move {
+        let service = FusionFlightService::new(ctx, Arc::new(admin), config, handles).await;
+        let svc = FlightServiceServer::new(service);
+        let tcp = Server::builder().add_service(svc.clone()).serve(addr);
+
+        // Serve the same service to co-located clients over a Unix domain
+        // socket, sparing them TCP loopback
+        match unix_socket {
+            Some(path) => {
+                // A socket left behind by a previous run would fail the bind
+                if std::fs::symlink_metadata(&path)
+                    .map_or(false, |meta| meta.file_type().is_socket())
+                {
+                    std::fs::remove_file(&path)?;
+                }
+                let listener = tokio::net::UnixListener::bind(&path)?;
+                let uds = Server::builder()
+                    .add_service(svc)
+                    .serve_with_incoming(UnixListenerStream::new(listener));
+                tokio::try_join!(tcp, uds)?;
+            }
+            None => tcp.await?,
+        }
+        Ok::<(), Box<dyn std::error::Error>>(())
+    })?;
     Ok(())
 }
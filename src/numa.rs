@@ -0,0 +1,187 @@
+use datafusion::arrow::error::ArrowError;
+use datafusion::arrow::record_batch::RecordBatch;
+use tokio::runtime::Handle;
+
+///////////////////
+// NUMA topology //
+///////////////////
+
+/* On hosts with several NUMA nodes, memory is fastest to read from the cores
+ * of the node it was allocated on. The topology is read from sysfs and
+ * restricted to the cores this process may run on; where sysfs has no node
+ * information (non-Linux hosts, containers), all allowed cores form a single
+ * node, and placement degenerates to the behavior without NUMA awareness.
+ *
+ * Linux allocates pages on the node of the thread that first touches them,
+ * so data is placed on a node by copying it from a thread pinned to that
+ * node's cores.
+ */
+
+#[derive(Clone, Debug)]
+pub struct NumaNode {
+    pub id: usize,
+    pub cpus: Vec<usize>,
+}
+
+#[derive(Clone, Debug)]
+pub struct NumaTopology {
+    pub nodes: Vec<NumaNode>,
+}
+
+#[cfg(target_os = "linux")]
+pub fn allowed_cores() -> Vec<usize> {
+    unsafe {
+        let mut set: libc::cpu_set_t = std::mem::zeroed();
+        if libc::sched_getaffinity(0, std::mem::size_of::<libc::cpu_set_t>(), &mut set) != 0 {
+            return vec![];
+        }
+        (0..libc::CPU_SETSIZE as usize)
+            .filter(|core| libc::CPU_ISSET(*core, &set))
+            .collect()
+    }
+}
+
+// Restrict the current thread to the given cores; pinning is best effort,
+// since an unpinned thread still works
+#[cfg(target_os = "linux")]
+pub fn pin_current_thread(cores: &[usize]) {
+    unsafe {
+        let mut set: libc::cpu_set_t = std::mem::zeroed();
+        for core in cores {
+            libc::CPU_SET(*core, &mut set);
+        }
+        libc::sched_setaffinity(0, std::mem::size_of::<libc::cpu_set_t>(), &set);
+    }
+}
+
+#[cfg(not(target_os = "linux"))]
+pub fn allowed_cores() -> Vec<usize> {
+    vec![]
+}
+
+#[cfg(not(target_os = "linux"))]
+pub fn pin_current_thread(_cores: &[usize]) {}
+
+// Parse a sysfs cpu list such as "0-3,8-11"
+fn parse_cpulist(list: &str) -> Option<Vec<usize>> {
+    let mut cpus = vec![];
+    for range in list.trim().split(',').filter(|r| !r.is_empty()) {
+        match range.split_once('-') {
+            Some((first, last)) => cpus.extend(first.parse::<usize>().ok()?..=last.parse().ok()?),
+            None => cpus.push(range.parse().ok()?),
+        }
+    }
+    Some(cpus)
+}
+
+impl NumaTopology {
+    pub fn single_node() -> Self {
+        let mut cpus = allowed_cores();
+        if cpus.is_empty() {
+            let parallelism = std::thread::available_parallelism().map_or(1, |n| n.get());
+            cpus = (0..parallelism).collect();
+        }
+        NumaTopology {
+            nodes: vec![NumaNode { id: 0, cpus: cpus }],
+        }
+    }
+
+    pub fn detect() -> Self {
+        let allowed = allowed_cores();
+        let mut nodes = vec![];
+        if let Ok(entries) = std::fs::read_dir("/sys/devices/system/node") {
+            for entry in entries.flatten() {
+                let name = entry.file_name().to_string_lossy().to_string();
+                let Some(id) = name.strip_prefix("node").and_then(|id| id.parse().ok()) else {
+                    continue;
+                };
+                let Some(cpus) = std::fs::read_to_string(entry.path().join("cpulist"))
+                    .ok()
+                    .and_then(|list| parse_cpulist(&list))
+                else {
+                    continue;
+                };
+                let cpus: Vec<usize> = cpus
+                    .into_iter()
+                    .filter(|cpu| allowed.is_empty() || allowed.contains(cpu))
+                    .collect();
+                // Memory-only nodes and nodes we may not run on are skipped
+                if !cpus.is_empty() {
+                    nodes.push(NumaNode { id: id, cpus: cpus });
+                }
+            }
+        }
+        if nodes.is_empty() {
+            return NumaTopology::single_node();
+        }
+        nodes.sort_by_key(|node| node.id);
+        NumaTopology { nodes: nodes }
+    }
+
+    pub fn len(&self) -> usize {
+        self.nodes.len()
+    }
+}
+
+///////////////////////////////
+// NUMA-aware data placement //
+///////////////////////////////
+
+/* Cached table partitions are assigned to nodes round-robin. Each partition
+ * is copied into memory local to its node when the table is loaded, and its
+ * scans are driven by the execution threads of that node.
+ */
+
+#[derive(Debug)]
+pub struct NumaPlacement {
+    pub topology: NumaTopology,
+    // Handle on the execution runtime of each node
+    pub handles: Vec<Handle>,
+}
+
+impl NumaPlacement {
+    pub fn node_of(&self, partition: usize) -> usize {
+        partition % self.topology.len()
+    }
+
+    // Copy each partition's batches into memory local to its node with copy,
+    // using one thread pinned to each node
+    pub fn place(
+        &self,
+        partitions: Vec<Vec<RecordBatch>>,
+        copy: impl Fn(&[RecordBatch]) -> Result<Vec<RecordBatch>, ArrowError> + Sync,
+    ) -> Result<Vec<Vec<RecordBatch>>, ArrowError> {
+        let copy = &copy;
+        let mut placed: Vec<Option<Vec<RecordBatch>>> = partitions.iter().map(|_| None).collect();
+        std::thread::scope(|scope| {
+            let workers: Vec<_> = self
+                .topology
+                .nodes
+                .iter()
+                .enumerate()
+                .map(|(n, node)| {
+                    let local: Vec<(usize, &Vec<RecordBatch>)> = partitions
+                        .iter()
+                        .enumerate()
+                        .filter(|(p, _)| self.node_of(*p) == n)
+                        .collect();
+                    scope.spawn(move || {
+                        pin_current_thread(&node.cpus);
+                        local
+                            .into_iter()
+                            .map(|(p, batches)| Ok((p, copy(batches)?)))
+                            .collect::<Result<Vec<_>, ArrowError>>()
+                    })
+                })
+                .collect();
+            for worker in workers {
+                let copied = worker.join().expect("NUMA placement thread panicked")?;
+                for (p, batches) in copied {
+                    placed[p] = Some(batches);
+                }
+            }
+            Ok::<(), ArrowError>(())
+        })?;
+        Ok(placed.into_iter().map(Option::unwrap_or_default).collect())
+    }
+}
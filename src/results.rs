@@ -0,0 +1,397 @@
+use crate::cancel::{deadline_passed, CancelToken};
+use datafusion::arrow::datatypes::SchemaRef;
+use datafusion::arrow::ipc::reader::StreamReader;
+use datafusion::arrow::ipc::writer::StreamWriter;
+use datafusion::arrow::record_batch::RecordBatch;
+use datafusion::error::{DataFusionError, Result};
+use datafusion::physical_plan::stream::RecordBatchStreamAdapter;
+use datafusion::physical_plan::SendableRecordBatchStream;
+use futures::StreamExt;
+use std::os::unix::fs::FileExt;
+use std::sync::atomic::{AtomicU64, AtomicUsize, Ordering};
+use std::sync::{Arc, Mutex};
+use std::time::Duration;
+use tokio::sync::Notify;
+use tokio::time::Instant;
+
+////////////////////
+// Result buffers //
+////////////////////
+
+/* The output of a query is drained once into a result buffer, from which
+ * any number of readers stream it, each from any batch index or row offset,
+ * including while the query is still producing it. This makes tickets
+ * reusable: an interrupted download resumes where it stopped instead of
+ * re-executing the query. It also decouples execution from delivery: the
+ * query runs at its own pace, and its pipeline, memory reservations and
+ * scans are released as soon as it finishes, however slowly clients read.
+ *
+ * Batches are kept in memory while the buffer holds less than the per-buffer
+ * limit of its pool, and all buffers of the pool together less than the pool
+ * limit; other batches are spilled to an unlinked temporary file, each as
+ * its own Arrow IPC stream segment so that it can be read back
+ * independently. The file is removed by the operating system once the
+ * buffer is dropped.
+ *
+ * A query nobody reads is not run to completion: its execution stops once
+ * no reader has been attached to its buffer for a grace period, long enough
+ * for an interrupted download to resume, or once the deadline of the
+ * request that started it passes.
+ */
+
+#[derive(Clone, Copy, Debug, PartialEq)]
+pub enum ResultRange {
+    // All batches starting from the given batch index
+    Batches { start: usize },
+    // Rows starting from the given row offset, up to limit rows if any
+    Rows { offset: usize, limit: Option<usize> },
+}
+
+// Memory and disk held by the result buffers sharing the pool
+#[derive(Debug)]
+pub struct ResultPool {
+    buffer_limit: usize,
+    limit: usize,
+    spill_dir: std::path::PathBuf,
+    memory_bytes: AtomicUsize,
+    spilled_bytes: AtomicU64,
+}
+
+impl ResultPool {
+    pub fn new(buffer_limit: usize, limit: usize, spill_dir: std::path::PathBuf) -> Self {
+        ResultPool {
+            buffer_limit: buffer_limit,
+            limit: limit,
+            spill_dir: spill_dir,
+            memory_bytes: AtomicUsize::new(0),
+            spilled_bytes: AtomicU64::new(0),
+        }
+    }
+
+    pub fn limit(&self) -> usize {
+        self.limit
+    }
+
+    pub fn memory_bytes(&self) -> usize {
+        self.memory_bytes.load(Ordering::Acquire)
+    }
+
+    pub fn spilled_bytes(&self) -> u64 {
+        self.spilled_bytes.load(Ordering::Acquire)
+    }
+
+    fn try_reserve(&self, bytes: usize) -> bool {
+        self.memory_bytes
+            .fetch_update(Ordering::AcqRel, Ordering::Acquire, |used| {
+                (used + bytes <= self.limit).then_some(used + bytes)
+            })
+            .is_ok()
+    }
+}
+
+enum Stored {
+    Memory(RecordBatch),
+    Spilled { offset: u64, len: usize },
+}
+
+struct BufferState {
+    batches: Vec<(Stored, usize)>,
+    memory_bytes: usize,
+    spill: Option<Arc<std::fs::File>>,
+    spill_bytes: u64,
+    // None while the query is still running
+    outcome: Option<std::result::Result<(), String>>,
+    // Number of streams reading the buffer, and since when there are none
+    readers: usize,
+    idle_since: Option<Instant>,
+}
+
+pub struct ResultBuffer {
+    schema: SchemaRef,
+    pool: Arc<ResultPool>,
+    state: Mutex<BufferState>,
+    changed: Notify,
+    // Notified when the last reader detaches
+    detached: Notify,
+}
+
+// A stream reading a buffer, attached to it for as long as it lives
+struct Reader(Arc<ResultBuffer>);
+
+impl Reader {
+    fn new(buffer: Arc<ResultBuffer>) -> Self {
+        let mut state = buffer.state.lock().unwrap();
+        state.readers += 1;
+        state.idle_since = None;
+        drop(state);
+        Reader(buffer)
+    }
+}
+
+impl Drop for Reader {
+    fn drop(&mut self) {
+        let mut state = self.0.state.lock().unwrap();
+        state.readers -= 1;
+        if state.readers == 0 {
+            state.idle_since = Some(Instant::now());
+            self.0.detached.notify_waiters();
+        }
+    }
+}
+
+fn batch_bytes(batch: &RecordBatch) -> usize {
+    batch
+        .columns()
+        .iter()
+        .map(|c| c.get_array_memory_size())
+        .sum()
+}
+
+fn encode_batch(batch: &RecordBatch) -> Result<Vec<u8>> {
+    let mut writer = StreamWriter::try_new(vec![], &batch.schema())?;
+    writer.write(batch)?;
+    writer.finish()?;
+    Ok(writer.into_inner()?)
+}
+
+fn decode_batch(bytes: Vec<u8>) -> Result<RecordBatch> {
+    let mut reader = StreamReader::try_new(std::io::Cursor::new(bytes), None)?;
+    reader
+        .next()
+        .transpose()?
+        .ok_or_else(|| DataFusionError::Internal("empty spilled result segment".to_string()))
+}
+
+async fn blocking<R: Send + 'static>(f: impl FnOnce() -> Result<R> + Send + 'static) -> Result<R> {
+    tokio::task::spawn_blocking(f)
+        .await
+        .map_err(|e| DataFusionError::Execution(format!("result buffer I/O failed: {e}")))?
+}
+
+impl ResultBuffer {
+    pub fn new(schema: SchemaRef, pool: Arc<ResultPool>) -> Self {
+        ResultBuffer {
+            schema: schema,
+            pool: pool,
+            state: Mutex::new(BufferState {
+                batches: vec![],
+                memory_bytes: 0,
+                spill: None,
+                spill_bytes: 0,
+                outcome: None,
+                readers: 0,
+                idle_since: Some(Instant::now()),
+            }),
+            changed: Notify::new(),
+            detached: Notify::new(),
+        }
+    }
+
+    pub fn schema(&self) -> SchemaRef {
+        self.schema.clone()
+    }
+
+    // Bytes of the result held in memory rather than spilled
+    pub fn memory_bytes(&self) -> usize {
+        self.state.lock().unwrap().memory_bytes
+    }
+
+    // Whether the query has ended, successfully or not
+    pub fn is_complete(&self) -> bool {
+        self.state.lock().unwrap().outcome.is_some()
+    }
+
+    async fn push(&self, batch: RecordBatch) -> Result<()> {
+        let rows = batch.num_rows();
+        let size = batch_bytes(&batch);
+        let spill = {
+            let mut state = self.state.lock().unwrap();
+            if state.memory_bytes + size <= self.pool.buffer_limit && self.pool.try_reserve(size) {
+                state.memory_bytes += size;
+                state.batches.push((Stored::Memory(batch), rows));
+                None
+            } else {
+                Some((state.spill.clone(), state.spill_bytes))
+            }
+        };
+
+        if let Some((file, offset)) = spill {
+            // Only the filling task writes, so the file and offset are ours
+            let dir = self.pool.spill_dir.clone();
+            let (file, len) = blocking(move || {
+                let file = match file {
+                    Some(file) => file,
+                    None => Arc::new(tempfile::tempfile_in(dir)?),
+                };
+                let bytes = encode_batch(&batch)?;
+                file.write_all_at(&bytes, offset)?;
+                Ok((file, bytes.len()))
+            })
+            .await?;
+            let mut state = self.state.lock().unwrap();
+            state.spill = Some(file);
+            state.spill_bytes += len as u64;
+            self.pool
+                .spilled_bytes
+                .fetch_add(len as u64, Ordering::AcqRel);
+            state.batches.push((
+                Stored::Spilled {
+                    offset: offset,
+                    len: len,
+                },
+                rows,
+            ));
+        }
+        self.changed.notify_waiters();
+        Ok(())
+    }
+
+    fn finish(&self, outcome: std::result::Result<(), String>) {
+        self.state.lock().unwrap().outcome = Some(outcome);
+        self.changed.notify_waiters();
+    }
+
+    // Resolves once no reader has been attached for the grace period
+    async fn abandoned(&self, grace: Duration) {
+        loop {
+            // Register for detaches before checking, so none are missed
+            let detached = self.detached.notified();
+            let idle_since = self.state.lock().unwrap().idle_since;
+            match idle_since {
+                Some(since) if since.elapsed() >= grace => return,
+                Some(since) => tokio::time::sleep_until(since + grace).await,
+                None => detached.await,
+            }
+        }
+    }
+
+    // Drain the input into the buffer until it ends, fails, the token is
+    // cancelled, the deadline passes, or no reader has been attached for
+    // the grace period
+    pub async fn fill(
+        &self,
+        mut input: SendableRecordBatchStream,
+        token: CancelToken,
+        deadline: Option<Instant>,
+        grace: Duration,
+    ) {
+        let abandoned = self.abandoned(grace);
+        tokio::pin!(abandoned);
+        loop {
+            let item = tokio::select! {
+                item = input.next() => item,
+                _ = token.cancelled() => {
+                    self.finish(Err("query cancelled".to_string()));
+                    return;
+                }
+                _ = deadline_passed(deadline) => {
+                    self.finish(Err("query deadline exceeded".to_string()));
+                    return;
+                }
+                _ = &mut abandoned => {
+                    self.finish(Err("query abandoned by its readers".to_string()));
+                    return;
+                }
+            };
+            let pushed = match item {
+                Some(Ok(batch)) => self.push(batch).await,
+                Some(Err(e)) => Err(e),
+                None => break,
+            };
+            if let Err(e) = pushed {
+                self.finish(Err(e.to_string()));
+                return;
+            }
+        }
+        self.finish(Ok(()));
+    }
+
+    // Batch at index, waiting for it to be produced, and its row count;
+    // the batch is not read when it holds no more than skip rows. None once
+    // the query has ended without producing it
+    async fn get(&self, index: usize, skip: usize) -> Option<Result<(Option<RecordBatch>, usize)>> {
+        loop {
+            // Register for changes before checking, so none are missed
+            let changed = self.changed.notified();
+            let spilled = {
+                let state = self.state.lock().unwrap();
+                match state.batches.get(index) {
+                    Some((_, rows)) if skip > 0 && *rows <= skip => return Some(Ok((None, *rows))),
+                    Some((Stored::Memory(batch), rows)) => {
+                        return Some(Ok((Some(batch.clone()), *rows)))
+                    }
+                    Some((Stored::Spilled { offset, len }, rows)) => {
+                        Some((state.spill.clone(), *offset, *len, *rows))
+                    }
+                    None => match &state.outcome {
+                        Some(Ok(())) => return None,
+                        Some(Err(e)) => return Some(Err(DataFusionError::Execution(e.clone()))),
+                        None => None,
+                    },
+                }
+            };
+            let Some((file, offset, len, rows)) = spilled else {
+                changed.await;
+                continue;
+            };
+            let Some(file) = file else {
+                return Some(Err(DataFusionError::Internal(
+                    "missing result spill file".to_string(),
+                )));
+            };
+            let batch = blocking(move || {
+                let mut bytes = vec![0; len];
+                file.read_exact_at(&mut bytes, offset)?;
+                decode_batch(bytes)
+            })
+            .await;
+            return Some(batch.map(|batch| (Some(batch), rows)));
+        }
+    }
+
+    // Stream the given range of the result
+    pub fn read(self: &Arc<Self>, range: ResultRange) -> SendableRecordBatchStream {
+        let (start, skip, limit) = match range {
+            ResultRange::Batches { start } => (start, 0, None),
+            ResultRange::Rows { offset, limit } => (0, offset, limit),
+        };
+        let stream = futures::stream::unfold(
+            Some((Reader::new(self.clone()), start, skip, limit)),
+            |state| async move {
+                let (reader, mut index, mut skip, limit) = state?;
+                let buffer = &reader.0;
+                loop {
+                    if limit == Some(0) {
+                        return None;
+                    }
+                    let (batch, rows) = match buffer.get(index, skip).await? {
+                        Ok(next) => next,
+                        Err(e) => return Some((Err(e), None)),
+                    };
+                    index += 1;
+                    let Some(batch) = batch else {
+                        // Whole batch before the row offset
+                        skip -= rows;
+                        continue;
+                    };
+                    let take = limit.map_or(rows - skip, |limit| limit.min(rows - skip));
+                    let limit = limit.map(|limit| limit - take);
+                    return Some((Ok(batch.slice(skip, take)), Some((reader, index, 0, limit))));
+                }
+            },
+        );
+        Box::pin(RecordBatchStreamAdapter::new(self.schema.clone(), stream))
+    }
+}
+
+impl Drop for ResultBuffer {
+    fn drop(&mut self) {
+        let state = self.state.get_mut().unwrap();
+        self.pool
+            .memory_bytes
+            .fetch_sub(state.memory_bytes, Ordering::AcqRel);
+        self.pool
+            .spilled_bytes
+            .fetch_sub(state.spill_bytes, Ordering::AcqRel);
+    }
+}
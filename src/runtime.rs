@@ -0,0 +1,252 @@
+use crate::numa::{allowed_cores, pin_current_thread, NumaPlacement, NumaTopology};
+use datafusion::arrow::datatypes::SchemaRef;
+use datafusion::arrow::record_batch::RecordBatch;
+use datafusion::error::Result;
+use datafusion::physical_plan::stream::RecordBatchStreamAdapter;
+use datafusion::physical_plan::SendableRecordBatchStream;
+use futures::future::BoxFuture;
+use futures::StreamExt;
+use std::sync::atomic::{AtomicUsize, Ordering};
+use std::sync::Arc;
+use tokio::runtime::{Builder, Handle, Runtime};
+use tokio::sync::mpsc;
+
+///////////////////////
+// Isolated runtimes //
+///////////////////////
+
+/* The service runs on three separate tokio runtimes:
+ * - io: serves gRPC, authenticates requests and moves encoded batches
+ *   between the executor and the network;
+ * - exec: plans and executes DataFusion streams, optionally with its
+ *   worker threads pinned to dedicated cores, and optionally split into
+ *   one runtime per NUMA node (see crate::numa);
+ * - ffi: a pool of blocking threads for calls into the SciDB client
+ *   library, which block on the network for the duration of a query.
+ * A saturated executor or a slow SciDB query therefore never delays
+ * handshakes, actions or the transfer of already computed results.
+ *
+ * Batches cross from exec to io through a bounded channel, so a slow client
+ * applies backpressure to its query instead of buffering its results.
+ */
+
+const EXCHANGE_BUFFER: usize = 2;
+
+#[derive(Clone, Debug)]
+pub struct RuntimeConfig {
+    pub io_threads: usize,
+    pub exec_threads: usize,
+    pub ffi_threads: usize,
+    // Pin io threads to the first io_threads allowed cores, and exec
+    // threads to the remaining ones
+    pub pin_threads: bool,
+    // Run one execution runtime per NUMA node, with its threads restricted
+    // to the node's cores
+    pub numa: bool,
+}
+
+impl Default for RuntimeConfig {
+    fn default() -> Self {
+        RuntimeConfig {
+            io_threads: 2,
+            exec_threads: std::thread::available_parallelism().map_or(1, |n| n.get()),
+            ffi_threads: 4,
+            pin_threads: false,
+            numa: false,
+        }
+    }
+}
+
+pub struct Runtimes {
+    pub io: Runtime,
+    pub exec: Vec<Runtime>,
+    pub ffi: Runtime,
+    // Placement of cached data on the nodes of the exec runtimes, if there
+    // are several
+    pub placement: Option<Arc<NumaPlacement>>,
+}
+
+// Handles on the runtimes the service hands work to
+#[derive(Clone, Debug)]
+pub struct ServiceRuntimes {
+    pub exec: Vec<Handle>,
+    pub ffi: Handle,
+    next: Arc<AtomicUsize>,
+}
+
+impl ServiceRuntimes {
+    // Run everything on the current runtime
+    pub fn current() -> Self {
+        let handle = Handle::current();
+        ServiceRuntimes {
+            exec: vec![handle.clone()],
+            ffi: handle,
+            next: Arc::new(AtomicUsize::new(0)),
+        }
+    }
+
+    // Execution runtime for the next query, spreading queries over nodes
+    pub fn exec(&self) -> &Handle {
+        let i = self.next.fetch_add(1, Ordering::Relaxed);
+        &self.exec[i % self.exec.len()]
+    }
+}
+
+enum Affinity {
+    None,
+    // Each thread pinned to one core, round-robin
+    PerCore(Vec<usize>),
+    // All threads restricted to the same set of cores
+    Set(Vec<usize>),
+}
+
+fn build_runtime(name: &str, threads: usize, affinity: Affinity) -> std::io::Result<Runtime> {
+    let mut builder = Builder::new_multi_thread();
+    builder
+        .worker_threads(threads.max(1))
+        .thread_name(name)
+        .enable_all();
+    match affinity {
+        Affinity::None => {}
+        Affinity::PerCore(cores) if !cores.is_empty() => {
+            let next = AtomicUsize::new(0);
+            builder.on_thread_start(move || {
+                let i = next.fetch_add(1, Ordering::Relaxed);
+                pin_current_thread(std::slice::from_ref(&cores[i % cores.len()]));
+            });
+        }
+        Affinity::PerCore(_) => {}
+        Affinity::Set(cores) => {
+            builder.on_thread_start(move || pin_current_thread(&cores));
+        }
+    }
+    builder.build()
+}
+
+impl Runtimes {
+    pub fn new(config: &RuntimeConfig) -> std::io::Result<Self> {
+        let (io_cores, exec_cores) = if config.pin_threads {
+            let cores = allowed_cores();
+            if cores.len() > config.io_threads {
+                let (io, exec) = cores.split_at(config.io_threads);
+                (io.to_vec(), exec.to_vec())
+            } else {
+                // Too few cores to dedicate any to io
+                (vec![], cores)
+            }
+        } else {
+            (vec![], vec![])
+        };
+
+        let io = build_runtime(
+            "rustyshim-io",
+            config.io_threads,
+            Affinity::PerCore(io_cores.clone()),
+        )?;
+
+        // One execution runtime per NUMA node, each with a share of the
+        // execution threads proportional to its cores, or a single one
+        let topology = if config.numa {
+            NumaTopology::detect()
+        } else {
+            NumaTopology::single_node()
+        };
+        let (exec, placement) = if topology.len() > 1 {
+            let total_cpus: usize = topology.nodes.iter().map(|n| n.cpus.len()).sum();
+            let exec = topology
+                .nodes
+                .iter()
+                .map(|node| {
+                    let cpus: Vec<usize> = node
+                        .cpus
+                        .iter()
+                        .copied()
+                        .filter(|cpu| !io_cores.contains(cpu))
+                        .collect();
+                    let threads = (config.exec_threads * node.cpus.len() / total_cpus).max(1);
+                    let affinity = match (config.pin_threads, cpus.is_empty()) {
+                        (_, true) => Affinity::Set(node.cpus.clone()),
+                        (true, false) => Affinity::PerCore(cpus),
+                        (false, false) => Affinity::Set(cpus),
+                    };
+                    build_runtime(&format!("rustyshim-exec-{}", node.id), threads, affinity)
+                })
+                .collect::<std::io::Result<Vec<_>>>()?;
+            let placement = NumaPlacement {
+                topology: topology,
+                handles: exec.iter().map(|rt| rt.handle().clone()).collect(),
+            };
+            (exec, Some(Arc::new(placement)))
+        } else {
+            let exec = build_runtime(
+                "rustyshim-exec",
+                config.exec_threads,
+                Affinity::PerCore(exec_cores),
+            )?;
+            (vec![exec], None)
+        };
+
+        // FFI calls only ever run via spawn_blocking
+        let ffi = Builder::new_multi_thread()
+            .worker_threads(1)
+            .max_blocking_threads(config.ffi_threads.max(1))
+            .thread_name("rustyshim-ffi")
+            .enable_all()
+            .build()?;
+        Ok(Runtimes {
+            io: io,
+            exec: exec,
+            ffi: ffi,
+            placement: placement,
+        })
+    }
+
+    pub fn handles(&self) -> ServiceRuntimes {
+        ServiceRuntimes {
+            exec: self.exec.iter().map(|rt| rt.handle().clone()).collect(),
+            ffi: self.ffi.handle().clone(),
+            next: Arc::new(AtomicUsize::new(0)),
+        }
+    }
+}
+
+// Create and drive a record batch stream on the given runtime, returning a
+// stream of its batches that can be consumed from any other runtime. The
+// stream is created on the target runtime as well, since DataFusion spawns
+// the tasks of some operators as soon as they are executed.
+pub fn execute_on(
+    handle: &Handle,
+    schema: SchemaRef,
+    create: impl FnOnce() -> BoxFuture<'static, Result<SendableRecordBatchStream>> + Send + 'static,
+) -> SendableRecordBatchStream {
+    let (tx, rx) = mpsc::channel::<Result<RecordBatch>>(EXCHANGE_BUFFER);
+    handle.spawn(async move {
+        let mut stream = match create().await {
+            Ok(stream) => stream,
+            Err(e) => {
+                let _ = tx.send(Err(e)).await;
+                return;
+            }
+        };
+        loop {
+            // Stop as soon as the consumer goes away, even mid-batch;
+            // dropping the stream cancels the execution
+            let item = tokio::select! {
+                item = stream.next() => item,
+                _ = tx.closed() => return,
+            };
+            match item {
+                Some(item) => {
+                    if tx.send(item).await.is_err() {
+                        return;
+                    }
+                }
+                None => return,
+            }
+        }
+    });
+    let batches = futures::stream::unfold(rx, |mut rx| async move {
+        rx.recv().await.map(|item| (item, rx))
+    });
+    Box::pin(RecordBatchStreamAdapter::new(schema, batches))
+}
@@ -1,5 +1,10 @@
 include!(concat!(env!("OUT_DIR"), "/bindings.rs"));
 
+use datafusion::arrow::array::{as_primitive_array, as_string_array, Array};
+use datafusion::arrow::compute::cast;
+use datafusion::arrow::datatypes::{
+    DataType, Field, Float64Type, Schema, TimeUnit, UInt64Type,
+};
 use datafusion::arrow::error::ArrowError;
 use datafusion::arrow::ipc;
 use datafusion::arrow::record_batch::RecordBatch;
@@ -344,3 +349,378 @@ impl SciDBConnection {
         Ok(aio)
     }
 }
+
+//////////////
+// AioStore //
+//////////////
+
+/* Store Arrow IPC streams, written by other threads into named pipes, into
+ * an array, with aio_input reading each pipe on the SciDB instance given for
+ * it, or the single pipe on the coordinator when no instances are given.
+ * The input may be transformed by an AFL expression of $input, for instance
+ * to redimension it, before being stored.
+ */
+
+pub fn aio_store_query(
+    array: &str,
+    transform: Option<&str>,
+    num_attributes: usize,
+    paths: &[std::path::PathBuf],
+    instances: &[i64],
+) -> Option<String> {
+    let paths: Vec<String> = paths
+        .iter()
+        .map(|path| path.to_str().map(|path| format!("'{}'", path)))
+        .collect::<Option<_>>()?;
+    let input = if instances.is_empty() {
+        format!(
+            "aio_input({}, num_attributes:{}, format:'arrow')",
+            paths.first()?,
+            num_attributes
+        )
+    } else {
+        let instances: Vec<String> = instances.iter().map(|i| i.to_string()).collect();
+        format!(
+            "aio_input(paths:({}), instances:({}), num_attributes:{}, format:'arrow')",
+            paths.join(","),
+            instances.join(","),
+            num_attributes
+        )
+    };
+    let input = match transform {
+        Some(transform) => transform.replace("$input", &input),
+        None => input,
+    };
+    Some(format!("store({}, {})", input, array))
+}
+
+impl SciDBConnection {
+    pub fn execute_aio_store(
+        &self,
+        array: &str,
+        transform: Option<&str>,
+        num_attributes: usize,
+        paths: &[std::path::PathBuf],
+        instances: &[i64],
+    ) -> Result<QueryID, SciDBError> {
+        // Wrap the input from the pipes in a store() into the array
+        let store_query = aio_store_query(array, transform, num_attributes, paths, instances)
+            .ok_or(SciDBError::QueryError {
+                code: SHIM_IO_ERROR,
+                explanation: "cannot convert path to string".to_owned(),
+            })?;
+
+        // Execute the SciDB query, reading data from the pipes until their
+        // streams end
+        self.execute_query(&store_query)
+    }
+}
+
+///////////////////
+// Appended rows //
+///////////////////
+
+/* Arrays growing along one dimension are refreshed by fetching only the
+ * cells of their query past the watermark, the highest coordinate along
+ * that dimension already loaded. When the dimension is one of the query's
+ * output, the cells are selected with between(), so that SciDB only reads
+ * the chunks past the watermark; a dimension exposed only as an attribute
+ * is selected with filter(), which reads every chunk.
+ *
+ * The cells up to the watermark must be the same as when they were loaded,
+ * which is checked, unless the array is configured to trust its appends, by
+ * SciDB computing a checksum of them on every refresh. Computing it reads
+ * all the cells up to the watermark. The checksum is the number of cells,
+ * and the sum over the cells of a weighted sum of their attributes, numbers
+ * as they are, booleans as 0 or 1 and strings by their length, weighted by
+ * the position of the attribute and by the coordinate of the cell. A
+ * checksum differing from the one computed when the cells were loaded means
+ * older cells were added, removed or updated, and the array must be
+ * reloaded in full. Array versions would not do, as appending cells makes a
+ * new version too.
+ *
+ * The checksum misses updates leaving it unchanged, such as a string
+ * replaced by another of the same length. A sum accumulated in a different
+ * order may differ in its last bits, which only costs a needless reload.
+ */
+
+#[derive(Clone, Copy, Debug, PartialEq)]
+pub struct CellChecksum {
+    pub cells: usize,
+    pub sum: f64,
+}
+
+// The cells of a query, whose output has the given dimensions, with a
+// coordinate along dimension between the bounds given, inclusive
+fn coordinate_range_query(
+    query: &str,
+    dimensions: &[String],
+    dimension: &str,
+    low: Option<i64>,
+    high: Option<i64>,
+) -> String {
+    let Some(position) = dimensions.iter().position(|name| name == dimension) else {
+        let mut conditions = vec![];
+        if let Some(low) = low {
+            conditions.push(format!("{} >= {}", dimension, low));
+        }
+        if let Some(high) = high {
+            conditions.push(format!("{} <= {}", dimension, high));
+        }
+        return format!("filter({}, {})", query, conditions.join(" and "));
+    };
+    // Other dimensions, and a missing bound, are left unbounded with null
+    let bounds = |bound: Option<i64>| {
+        (0..dimensions.len())
+            .map(|d| match bound {
+                Some(bound) if d == position => bound.to_string(),
+                _ => String::from("null"),
+            })
+            .collect::<Vec<_>>()
+            .join(", ")
+    };
+    format!("between({}, {}, {})", query, bounds(low), bounds(high))
+}
+
+pub fn appended_query(
+    query: &str,
+    dimensions: &[String],
+    dimension: &str,
+    watermark: i64,
+) -> String {
+    coordinate_range_query(query, dimensions, dimension, Some(watermark + 1), None)
+}
+
+// The term of an attribute in the checksum of a cell, if it has one
+fn checksum_term(field: &Field) -> Option<String> {
+    let name = field.name();
+    let value = match field.data_type() {
+        DataType::Boolean => format!("iif({}, 1.0, 0.0)", name),
+        DataType::Utf8 | DataType::LargeUtf8 => format!("double(strlen({}))", name),
+        DataType::Int8
+        | DataType::Int16
+        | DataType::Int32
+        | DataType::Int64
+        | DataType::UInt8
+        | DataType::UInt16
+        | DataType::UInt32
+        | DataType::UInt64
+        | DataType::Float32
+        | DataType::Float64 => format!("double({})", name),
+        _ => return None,
+    };
+    Some(format!("iif(is_null({}), 0.5, {})", name, value))
+}
+
+pub fn checksum_query(
+    query: &str,
+    dimensions: &[String],
+    schema: &Schema,
+    dimension: &str,
+    watermark: i64,
+) -> String {
+    let terms: Vec<String> = schema
+        .fields()
+        .iter()
+        .filter_map(checksum_term)
+        .enumerate()
+        .map(|(k, term)| format!("{}*{}", k + 1, term))
+        .collect();
+    let terms = match terms.is_empty() {
+        true => String::from("0.0"),
+        false => terms.join("+"),
+    };
+    let checksum = format!("({})*({} % 1009 + 1)", terms, dimension);
+    let loaded = coordinate_range_query(query, dimensions, dimension, None, Some(watermark));
+    format!(
+        "aggregate(apply({}, _checksum, {}), count(*), sum(_checksum))",
+        loaded, checksum
+    )
+}
+
+impl SciDBConnection {
+    // The names of the dimensions of a query's output
+    pub fn query_dimensions(&self, query: &str) -> Result<Vec<String>, SciDBError> {
+        let quoted = query.replace('\\', "\\\\").replace('\'', "\\'");
+        let show = format!("show('{}', 'afl')", quoted);
+        let batches = self.execute_aio_query(&show)?.to_batches()?;
+        let schema = string_values(&batches, "schema")?;
+        schema
+            .first()
+            .and_then(|schema| parse_array_schema(schema))
+            .map(|(_, dimensions)| dimensions)
+            .ok_or(SciDBError::QueryError {
+                code: SHIM_IO_ERROR,
+                explanation: "cannot parse the schema of a query".to_owned(),
+            })
+    }
+
+    // The checksum of the cells of a query up to the watermark, whose
+    // output has the given dimensions and schema
+    pub fn execute_cell_checksum(
+        &self,
+        query: &str,
+        dimensions: &[String],
+        schema: &Schema,
+        dimension: &str,
+        watermark: i64,
+    ) -> Result<CellChecksum, SciDBError> {
+        let checksum_query = checksum_query(query, dimensions, schema, dimension, watermark);
+        let batches = self.execute_aio_query(&checksum_query)?.to_batches()?;
+        let batch =
+            batches
+                .iter()
+                .find(|batch| batch.num_rows() > 0)
+                .ok_or(SciDBError::QueryError {
+                    code: SHIM_IO_ERROR,
+                    explanation: "checksum query returned no cells".to_owned(),
+                })?;
+        let cells = cast(batch.column(0), &DataType::UInt64)?;
+        let sum = cast(batch.column(1), &DataType::Float64)?;
+        let sum = as_primitive_array::<Float64Type>(&sum);
+        Ok(CellChecksum {
+            // Summing no cells gives null
+            cells: as_primitive_array::<UInt64Type>(&cells).value(0) as usize,
+            sum: if sum.is_null(0) { 0.0 } else { sum.value(0) },
+        })
+    }
+}
+
+/////////////
+// Catalog //
+/////////////
+
+/* The arrays of each namespace are listed with list('arrays'), along with
+ * their schemas, from which the Arrow schema of their table is derived: the
+ * attributes, followed by the dimensions, which are exposed as int64
+ * attributes with apply(), as configured arrays do by hand. Arrays with an
+ * attribute of a type that has no Arrow counterpart are left out.
+ */
+
+#[derive(Clone, Debug)]
+pub struct ArrayInfo {
+    pub namespace: String,
+    pub name: String,
+    // Attribute names and SciDB types
+    pub attributes: Vec<(String, String)>,
+    pub dimensions: Vec<String>,
+}
+
+// Split a SciDB array schema, such as
+//   A<x:int64 NOT NULL,y:string> [i=0:*:0:1000;j=0:9:0:10]
+// into its attributes and the names of its dimensions
+pub fn parse_array_schema(schema: &str) -> Option<(Vec<(String, String)>, Vec<String>)> {
+    let attributes = schema.get(schema.find('<')? + 1..schema.find('>')?)?;
+    let dimensions = schema.get(schema.find('[')? + 1..schema.rfind(']')?)?;
+    let attributes = attributes
+        .split(',')
+        .map(|attribute| {
+            let (name, declaration) = attribute.split_once(':')?;
+            let scidb_type = declaration.split_whitespace().next()?;
+            Some((name.trim().to_string(), scidb_type.to_string()))
+        })
+        .collect::<Option<Vec<_>>>()?;
+    // Dimensions are separated by semicolons, or by commas in older
+    // releases, which also separate their chunk parameters
+    let dimensions = dimensions
+        .split(|c| c == ';' || c == ',')
+        .map(|dimension| dimension.split('=').next().unwrap_or("").trim())
+        .filter(|name| name.starts_with(|c: char| c.is_ascii_alphabetic() || c == '_'))
+        .map(String::from)
+        .collect();
+    Some((attributes, dimensions))
+}
+
+// The Arrow type in which aio_save writes a SciDB type
+pub fn arrow_type(scidb_type: &str) -> Option<DataType> {
+    match scidb_type {
+        "bool" => Some(DataType::Boolean),
+        "int8" => Some(DataType::Int8),
+        "int16" => Some(DataType::Int16),
+        "int32" => Some(DataType::Int32),
+        "int64" => Some(DataType::Int64),
+        "uint8" => Some(DataType::UInt8),
+        "uint16" => Some(DataType::UInt16),
+        "uint32" => Some(DataType::UInt32),
+        "uint64" => Some(DataType::UInt64),
+        "float" => Some(DataType::Float32),
+        "double" => Some(DataType::Float64),
+        "string" => Some(DataType::Utf8),
+        "binary" => Some(DataType::Binary),
+        "datetime" => Some(DataType::Timestamp(TimeUnit::Second, None)),
+        _ => None,
+    }
+}
+
+impl ArrayInfo {
+    // The schema of the array's table, if all its attributes can be read
+    pub fn arrow_schema(&self) -> Option<Schema> {
+        let attributes = self.attributes.iter().map(|(name, scidb_type)| {
+            arrow_type(scidb_type).map(|data_type| Field::new(name, data_type, true))
+        });
+        let dimensions = self
+            .dimensions
+            .iter()
+            .map(|name| Some(Field::new(name, DataType::Int64, true)));
+        let fields = attributes.chain(dimensions).collect::<Option<Vec<_>>>()?;
+        Some(Schema::new(fields))
+    }
+
+    // AFL reading the array with its dimensions as attributes
+    pub fn afl(&self) -> String {
+        let mut afl = match self.namespace.as_str() {
+            "public" => self.name.clone(),
+            namespace => format!("{}.{}", namespace, self.name),
+        };
+        if !self.dimensions.is_empty() {
+            let applied: Vec<String> = self
+                .dimensions
+                .iter()
+                .map(|name| format!("{},{}", name, name))
+                .collect();
+            afl = format!("apply({},{})", afl, applied.join(","));
+        }
+        afl
+    }
+}
+
+// The values of a string attribute of a query's output
+fn string_values(batches: &[RecordBatch], name: &str) -> Result<Vec<String>, SciDBError> {
+    let mut values = vec![];
+    for batch in batches {
+        let column = cast(
+            batch.column(batch.schema().index_of(name)?),
+            &DataType::Utf8,
+        )?;
+        let column = as_string_array(&column);
+        values.extend((0..column.len()).map(|i| column.value(i).to_string()));
+    }
+    Ok(values)
+}
+
+impl SciDBConnection {
+    pub fn list_namespaces(&self) -> Result<Vec<String>, SciDBError> {
+        let batches = self.execute_aio_query("list('namespaces')")?.to_batches()?;
+        string_values(&batches, "name")
+    }
+
+    pub fn list_arrays(&self, namespace: &str) -> Result<Vec<ArrayInfo>, SciDBError> {
+        let query = format!("list('arrays', ns:{})", namespace);
+        let batches = self.execute_aio_query(&query)?.to_batches()?;
+        let names = string_values(&batches, "name")?;
+        let schemas = string_values(&batches, "schema")?;
+        Ok(names
+            .into_iter()
+            .zip(schemas)
+            .filter_map(|(name, schema)| {
+                let (attributes, dimensions) = parse_array_schema(&schema)?;
+                Some(ArrayInfo {
+                    namespace: namespace.to_string(),
+                    name: name,
+                    attributes: attributes,
+                    dimensions: dimensions,
+                })
+            })
+            .collect())
+    }
+}
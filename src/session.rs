@@ -0,0 +1,273 @@
+use datafusion::catalog::catalog::{CatalogProvider, MemoryCatalogProvider};
+use datafusion::catalog::schema::SchemaProvider;
+use datafusion::datasource::TableProvider;
+use datafusion::error::{DataFusionError, Result};
+use datafusion::logical_expr::TableType;
+use datafusion::prelude::*;
+use std::any::Any;
+use std::collections::HashMap;
+use std::sync::atomic::{AtomicU64, AtomicUsize, Ordering};
+use std::sync::{Arc, RwLock};
+
+///////////////////////////
+// Session-scoped tables //
+///////////////////////////
+
+/* Each session may upload tables of its own through do_put, for instance
+ * lists of keys to join against cached tables, create views, and cache the
+ * results of queries in tables with CACHE TABLE, for instance an expensive
+ * join to explore further. They are visible only to the queries of that
+ * session, which are planned in a context of their own whose
+ * default schema layers the session's tables over the tables of the shared
+ * context; a session table shadows a shared table of the same name. The
+ * other schemas of the shared context, such as those of discovered SciDB
+ * namespaces, are read-only to sessions. Uploaded record batches are
+ * registered as decoded, without being copied again.
+ *
+ * The bytes held by each session's tables are bounded by a quota, and those
+ * of all sessions together by a budget; views hold none. A session's tables
+ * are released once the session expires.
+ */
+
+#[derive(Debug)]
+pub struct TempTableBudget {
+    // Bytes each session may hold
+    pub quota: usize,
+    // Bytes all sessions together may hold
+    pub max_bytes: usize,
+    bytes: AtomicUsize,
+}
+
+impl TempTableBudget {
+    pub fn new(quota: usize, max_bytes: usize) -> Self {
+        TempTableBudget {
+            quota: quota,
+            max_bytes: max_bytes,
+            bytes: AtomicUsize::new(0),
+        }
+    }
+
+    pub fn bytes(&self) -> usize {
+        self.bytes.load(Ordering::Acquire)
+    }
+
+    fn try_reserve(&self, bytes: usize) -> bool {
+        self.bytes
+            .fetch_update(Ordering::AcqRel, Ordering::Acquire, |used| {
+                (used + bytes <= self.max_bytes).then_some(used + bytes)
+            })
+            .is_ok()
+    }
+
+    fn release(&self, bytes: usize) {
+        self.bytes.fetch_sub(bytes, Ordering::AcqRel);
+    }
+}
+
+pub struct SessionTables {
+    budget: Arc<TempTableBudget>,
+    // Tables by name, with the bytes they hold
+    tables: RwLock<HashMap<String, (Arc<dyn TableProvider>, usize)>>,
+    // Incremented on every change of the tables, so that the keys of the
+    // queries planned against them change along with them
+    version: AtomicU64,
+}
+
+impl SessionTables {
+    pub fn new(budget: Arc<TempTableBudget>) -> Self {
+        SessionTables {
+            budget: budget,
+            tables: RwLock::new(HashMap::new()),
+            version: AtomicU64::new(0),
+        }
+    }
+
+    pub fn is_empty(&self) -> bool {
+        self.tables.read().unwrap().is_empty()
+    }
+
+    pub fn version(&self) -> u64 {
+        self.version.load(Ordering::Acquire)
+    }
+
+    // Register a table holding the given bytes, replacing any table of the
+    // same name, unless that would exceed the session's quota or the budget
+    pub fn register(
+        &self,
+        name: String,
+        table: Arc<dyn TableProvider>,
+        bytes: usize,
+    ) -> Result<()> {
+        let mut tables = self.tables.write().unwrap();
+        let held: usize = tables.values().map(|(_, bytes)| bytes).sum();
+        let replaced = tables.get(&name).map_or(0, |(_, bytes)| *bytes);
+        if held - replaced + bytes > self.budget.quota {
+            return Err(DataFusionError::ResourcesExhausted(format!(
+                "session table quota of {} bytes exceeded",
+                self.budget.quota
+            )));
+        }
+        if !self.budget.try_reserve(bytes) {
+            return Err(DataFusionError::ResourcesExhausted(
+                "session table memory exhausted".to_string(),
+            ));
+        }
+        tables.insert(name, (table, bytes));
+        self.version.fetch_add(1, Ordering::AcqRel);
+        self.budget.release(replaced);
+        Ok(())
+    }
+
+    pub fn deregister(&self, name: &str) -> Option<Arc<dyn TableProvider>> {
+        let mut tables = self.tables.write().unwrap();
+        let (table, bytes) = tables.remove(name)?;
+        self.version.fetch_add(1, Ordering::AcqRel);
+        self.budget.release(bytes);
+        Some(table)
+    }
+
+    fn get(&self, name: &str) -> Option<Arc<dyn TableProvider>> {
+        let tables = self.tables.read().unwrap();
+        tables.get(name).map(|(table, _)| table.clone())
+    }
+
+    fn names(&self) -> Vec<String> {
+        self.tables.read().unwrap().keys().cloned().collect()
+    }
+}
+
+impl Drop for SessionTables {
+    fn drop(&mut self) {
+        let tables = self.tables.get_mut().unwrap();
+        self.budget
+            .release(tables.values().map(|(_, bytes)| bytes).sum());
+    }
+}
+
+// Schema resolving names to the session's tables first, then to the tables
+// of the shared schema underneath
+struct OverlaySchema {
+    session: Arc<SessionTables>,
+    shared: Arc<dyn SchemaProvider>,
+}
+
+#[tonic::async_trait]
+impl SchemaProvider for OverlaySchema {
+    fn as_any(&self) -> &dyn Any {
+        self
+    }
+
+    fn table_names(&self) -> Vec<String> {
+        let mut names = self.session.names();
+        names.extend(
+            self.shared
+                .table_names()
+                .into_iter()
+                .filter(|name| self.session.get(name).is_none()),
+        );
+        names
+    }
+
+    async fn table(&self, name: &str) -> Option<Arc<dyn TableProvider>> {
+        match self.session.get(name) {
+            Some(table) => Some(table),
+            None => self.shared.table(name).await,
+        }
+    }
+
+    // Views hold a plan rather than data, so they take nothing from the
+    // session's quota; tables are registered by uploading or caching them
+    fn register_table(
+        &self,
+        name: String,
+        table: Arc<dyn TableProvider>,
+    ) -> Result<Option<Arc<dyn TableProvider>>> {
+        if table.table_type() != TableType::View {
+            return Err(DataFusionError::NotImplemented(
+                "session tables can only be uploaded or created with CACHE TABLE".to_string(),
+            ));
+        }
+        let replaced = self.session.get(&name);
+        self.session.register(name, table, 0)?;
+        Ok(replaced)
+    }
+
+    fn deregister_table(&self, name: &str) -> Result<Option<Arc<dyn TableProvider>>> {
+        Ok(self.session.deregister(name))
+    }
+
+    fn table_exist(&self, name: &str) -> bool {
+        self.session.get(name).is_some() || self.shared.table_exist(name)
+    }
+}
+
+// Schema of the shared context other than the default one, such as that of
+// a discovered namespace, which sessions may read but not change
+struct SharedSchema {
+    name: String,
+    shared: Arc<dyn SchemaProvider>,
+}
+
+#[tonic::async_trait]
+impl SchemaProvider for SharedSchema {
+    fn as_any(&self) -> &dyn Any {
+        self
+    }
+
+    fn table_names(&self) -> Vec<String> {
+        self.shared.table_names()
+    }
+
+    async fn table(&self, name: &str) -> Option<Arc<dyn TableProvider>> {
+        self.shared.table(name).await
+    }
+
+    fn register_table(
+        &self,
+        _name: String,
+        _table: Arc<dyn TableProvider>,
+    ) -> Result<Option<Arc<dyn TableProvider>>> {
+        Err(DataFusionError::Plan(format!("schema {} is read-only", self.name)))
+    }
+
+    fn deregister_table(&self, _name: &str) -> Result<Option<Arc<dyn TableProvider>>> {
+        Err(DataFusionError::Plan(format!("schema {} is read-only", self.name)))
+    }
+
+    fn table_exist(&self, name: &str) -> bool {
+        self.shared.table_exist(name)
+    }
+}
+
+// Context sharing the configuration, runtime and tables of the shared
+// context, whose default schema is overlaid with the session's tables and
+// whose other schemas are read-only
+pub fn session_context(
+    shared: &SessionContext,
+    session: Arc<SessionTables>,
+) -> Result<SessionContext> {
+    let ctx = SessionContext::with_config_rt(shared.copied_config(), shared.runtime_env());
+    let shared_catalog = shared
+        .catalog("datafusion")
+        .ok_or_else(|| DataFusionError::Internal("catalog 'datafusion' must exist".to_string()))?;
+    let catalog = MemoryCatalogProvider::new();
+    for name in shared_catalog.schema_names() {
+        let Some(schema) = shared_catalog.schema(&name) else {
+            continue;
+        };
+        let schema: Arc<dyn SchemaProvider> = if name == "public" {
+            Arc::new(OverlaySchema {
+                session: session.clone(),
+                shared: schema,
+            })
+        } else {
+            Arc::new(SharedSchema {
+                name: name.clone(),
+                shared: schema,
+            })
+        };
+        catalog.register_schema(&name, schema)?;
+    }
+    ctx.register_catalog("datafusion", Arc::new(catalog));
+    Ok(ctx)
+}
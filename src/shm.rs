@@ -0,0 +1,145 @@
+use datafusion::arrow::ipc::writer::FileWriter;
+use datafusion::arrow::record_batch::RecordBatch;
+use datafusion::error::{DataFusionError, Result};
+use datafusion::physical_plan::SendableRecordBatchStream;
+use futures::StreamExt;
+use rand::{distributions::Alphanumeric, Rng};
+use std::collections::HashMap;
+use std::os::unix::fs::OpenOptionsExt;
+use std::path::PathBuf;
+use std::sync::atomic::{AtomicUsize, Ordering};
+use std::sync::{Arc, Mutex, Weak};
+
+////////////////////////////////
+// Shared-memory result files //
+////////////////////////////////
+
+/* Clients on the same host can have a query result exported into an Arrow
+ * IPC file on a memory-backed filesystem (/dev/shm by default) and map it
+ * into their own address space, reading the data with no copy and without
+ * going through gRPC at all.
+ *
+ * Files are created readable by the server's user and group only, and are
+ * removed once no ticket refers to them; clients that mapped a file keep
+ * their mapping. Identical queries against the same context generation share
+ * a file, so repeated full-table exports hand out the existing file. The
+ * total size of exported files is bounded, since they occupy memory.
+ */
+
+pub struct SharedExports {
+    dir: PathBuf,
+    max_bytes: usize,
+    bytes: AtomicUsize,
+    // Exported files by query key
+    files: Mutex<HashMap<String, Weak<SharedFile>>>,
+}
+
+pub struct SharedFile {
+    pub path: PathBuf,
+    pub rows: usize,
+    pub bytes: usize,
+    exports: Arc<SharedExports>,
+}
+
+impl Drop for SharedFile {
+    fn drop(&mut self) {
+        let _ = std::fs::remove_file(&self.path);
+        self.exports.bytes.fetch_sub(self.bytes, Ordering::AcqRel);
+    }
+}
+
+fn batch_bytes(batch: &RecordBatch) -> usize {
+    batch
+        .columns()
+        .iter()
+        .map(|c| c.get_array_memory_size())
+        .sum()
+}
+
+impl SharedExports {
+    pub fn new(dir: PathBuf, max_bytes: usize) -> Self {
+        SharedExports {
+            dir: dir,
+            max_bytes: max_bytes,
+            bytes: AtomicUsize::new(0),
+            files: Mutex::new(HashMap::new()),
+        }
+    }
+
+    // Bytes of exported files currently in place
+    pub fn bytes(&self) -> usize {
+        self.bytes.load(Ordering::Acquire)
+    }
+
+    fn reserve(&self, bytes: usize) -> Result<()> {
+        self.bytes
+            .fetch_update(Ordering::AcqRel, Ordering::Acquire, |used| {
+                (used + bytes <= self.max_bytes).then_some(used + bytes)
+            })
+            .map(|_| ())
+            .map_err(|_| {
+                DataFusionError::ResourcesExhausted(
+                    "shared-memory export limit reached".to_string(),
+                )
+            })
+    }
+
+    // Export a result into a new shared-memory file, or hand out the file
+    // of an earlier export of the same query key
+    pub async fn export(
+        self: &Arc<Self>,
+        key: &str,
+        mut result: SendableRecordBatchStream,
+    ) -> Result<Arc<SharedFile>> {
+        if let Some(file) = self.files.lock().unwrap().get(key).and_then(Weak::upgrade) {
+            return Ok(file);
+        }
+
+        let name: String = rand::thread_rng()
+            .sample_iter(&Alphanumeric)
+            .take(32)
+            .map(char::from)
+            .collect();
+        let path = self.dir.join(format!("rustyshim-{name}.arrow"));
+        let file = std::fs::OpenOptions::new()
+            .write(true)
+            .create_new(true)
+            .mode(0o640)
+            .open(&path)?;
+        // Removes the file, and returns its reservation, on any error below
+        let mut exported = SharedFile {
+            path: path,
+            rows: 0,
+            bytes: 0,
+            exports: self.clone(),
+        };
+
+        // Writes go to memory, so they are made directly from this task
+        let mut writer = FileWriter::try_new(file.try_clone()?, &result.schema())?;
+        while let Some(batch) = result.next().await {
+            let batch = batch?;
+            let bytes = batch_bytes(&batch);
+            self.reserve(bytes)?;
+            exported.bytes += bytes;
+            exported.rows += batch.num_rows();
+            writer.write(&batch)?;
+        }
+        writer.finish()?;
+
+        // Account for the actual size of the file from now on
+        let size = file.metadata()?.len() as usize;
+        if size > exported.bytes {
+            self.reserve(size - exported.bytes)?;
+        } else {
+            self.bytes
+                .fetch_sub(exported.bytes - size, Ordering::AcqRel);
+        }
+        exported.bytes = size;
+
+        let exported = Arc::new(exported);
+        let mut files = self.files.lock().unwrap();
+        files.retain(|_, file| file.strong_count() > 0);
+        files.insert(key.to_string(), Arc::downgrade(&exported));
+        Ok(exported)
+    }
+}
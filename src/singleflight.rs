@@ -0,0 +1,242 @@
+use datafusion::arrow::datatypes::SchemaRef;
+use datafusion::arrow::record_batch::RecordBatch;
+use datafusion::error::DataFusionError;
+use datafusion::physical_plan::stream::RecordBatchStreamAdapter;
+use datafusion::physical_plan::SendableRecordBatchStream;
+use datafusion::sql::sqlparser::dialect::GenericDialect;
+use datafusion::sql::sqlparser::parser::Parser;
+use futures::StreamExt;
+use std::collections::HashMap;
+use std::sync::{Arc, Mutex, Weak};
+use tokio::sync::mpsc;
+
+///////////////////////////////////////
+// Single-flight query deduplication //
+///////////////////////////////////////
+
+/* Identical queries submitted concurrently against the same context
+ * generation are executed only once. The first ticket executed for a query
+ * key becomes the leader and drives the DataFusion stream in a background
+ * task; tickets for the same key executed later subscribe to it and receive
+ * the same (reference-counted) record batches.
+ *
+ * Each subscriber has its own bounded channel, and the leader waits for
+ * room in every subscriber's channel before pulling the next batch, so the
+ * execution proceeds at the pace of the slowest subscriber. Subscribers are
+ * result buffers (see crate::results), which drain their channel regardless
+ * of how fast clients read. Batches already produced are kept for replay to
+ * late subscribers until they exceed MAX_REPLAY_BYTES, after which the query
+ * no longer accepts subscribers and identical queries start their own
+ * execution.
+ */
+
+const SUBSCRIBER_BUFFER: usize = 8;
+const MAX_REPLAY_BYTES: usize = 64 * 1024 * 1024;
+
+type SharedItem = Result<RecordBatch, String>;
+
+// The text of a query as printed back from its parsed statements, so that
+// spellings differing only in whitespace, comments or a trailing semicolon
+// share a key; text that does not parse is keyed as given
+pub fn canonical_sql(query: &str) -> String {
+    match Parser::parse_sql(&GenericDialect {}, query) {
+        Ok(statements) => statements
+            .iter()
+            .map(|statement| statement.to_string())
+            .collect::<Vec<_>>()
+            .join("; "),
+        Err(_) => query.to_string(),
+    }
+}
+
+struct SharedState {
+    // None once the query stopped accepting new subscribers
+    replay: Option<Vec<RecordBatch>>,
+    replay_bytes: usize,
+    subscribers: Vec<mpsc::Sender<SharedItem>>,
+    done: bool,
+}
+
+pub struct SharedQuery {
+    schema: SchemaRef,
+    state: Mutex<SharedState>,
+}
+
+impl SharedQuery {
+    fn new(schema: SchemaRef) -> Self {
+        SharedQuery {
+            schema: schema,
+            state: Mutex::new(SharedState {
+                replay: Some(vec![]),
+                replay_bytes: 0,
+                subscribers: vec![],
+                done: false,
+            }),
+        }
+    }
+
+    // Attach a new subscriber, replaying the batches produced so far;
+    // returns None if the query no longer accepts subscribers
+    fn subscribe(&self) -> Option<SendableRecordBatchStream> {
+        let mut state = self.state.lock().unwrap();
+        let replay = state.replay.as_ref()?.clone();
+        let replayed = futures::stream::iter(replay.into_iter().map(Ok::<_, String>));
+        let stream = if state.done {
+            replayed.boxed()
+        } else {
+            let (tx, rx) = mpsc::channel(SUBSCRIBER_BUFFER);
+            state.subscribers.push(tx);
+            let live = futures::stream::unfold(rx, |mut rx| async move {
+                rx.recv().await.map(|item| (item, rx))
+            });
+            replayed.chain(live).boxed()
+        };
+        let stream = stream.map(|item| item.map_err(DataFusionError::Execution));
+        Some(Box::pin(RecordBatchStreamAdapter::new(
+            self.schema.clone(),
+            stream,
+        )))
+    }
+
+    // Resolves once every subscriber has gone away, after which the query
+    // accepts no new subscribers
+    async fn abandoned(&self) {
+        loop {
+            let subscribers = {
+                let mut state = self.state.lock().unwrap();
+                state.subscribers.retain(|tx| !tx.is_closed());
+                if state.subscribers.is_empty() {
+                    state.replay = None;
+                    return;
+                }
+                state.subscribers.clone()
+            };
+            // Subscribers that joined in the meantime are picked up on the
+            // next iteration
+            futures::future::join_all(subscribers.iter().map(|tx| tx.closed())).await;
+        }
+    }
+
+    // Drive the underlying execution, fanning out every item to all
+    // subscribers; stops as soon as every subscriber has gone away, even
+    // while waiting for the next item, which drops (and so cancels) the
+    // execution. on_closed is called (without holding the state lock) once
+    // the query stops accepting subscribers
+    async fn run(&self, mut input: SendableRecordBatchStream, on_closed: impl Fn()) {
+        loop {
+            let item = tokio::select! {
+                item = input.next() => item,
+                _ = self.abandoned() => {
+                    on_closed();
+                    return;
+                }
+            };
+            let Some(item) = item else {
+                break;
+            };
+            let item = item.map_err(|e| e.to_string());
+            let (subscribers, closed) = {
+                let mut state = self.state.lock().unwrap();
+                if let Ok(batch) = &item {
+                    state.replay_bytes += batch
+                        .columns()
+                        .iter()
+                        .map(|c| c.get_array_memory_size())
+                        .sum::<usize>();
+                    if state.replay_bytes > MAX_REPLAY_BYTES {
+                        state.replay = None;
+                    }
+                    if let Some(replay) = state.replay.as_mut() {
+                        replay.push(batch.clone());
+                    }
+                }
+                (state.subscribers.clone(), state.replay.is_none())
+            };
+            if closed {
+                on_closed();
+            }
+            for tx in subscribers.iter() {
+                let _ = tx.send(item.clone()).await;
+            }
+            let abandoned = {
+                let mut state = self.state.lock().unwrap();
+                state.subscribers.retain(|tx| !tx.is_closed());
+                if state.subscribers.is_empty() {
+                    state.replay = None;
+                }
+                state.subscribers.is_empty()
+            };
+            if abandoned {
+                // Nobody is listening; drop the execution
+                on_closed();
+                return;
+            }
+        }
+        {
+            let mut state = self.state.lock().unwrap();
+            state.done = true;
+            state.subscribers.clear();
+        }
+        on_closed();
+    }
+}
+
+pub struct SingleFlight {
+    inflight: Mutex<HashMap<String, Weak<SharedQuery>>>,
+}
+
+impl SingleFlight {
+    pub fn new() -> Self {
+        SingleFlight {
+            inflight: Mutex::new(HashMap::new()),
+        }
+    }
+
+    // Subscribe to an in-flight execution of the query key, if there is one
+    pub fn join(&self, key: &str) -> Option<SendableRecordBatchStream> {
+        let inflight = self.inflight.lock().unwrap();
+        inflight.get(key)?.upgrade()?.subscribe()
+    }
+
+    // Become the leader for the query key, executing the input stream in the
+    // background; if another leader registered in the meantime, subscribe to
+    // it instead and drop the input
+    pub fn lead(
+        self: &Arc<Self>,
+        key: String,
+        input: SendableRecordBatchStream,
+    ) -> SendableRecordBatchStream {
+        let mut inflight = self.inflight.lock().unwrap();
+        if let Some(stream) = inflight
+            .get(&key)
+            .and_then(|existing| existing.upgrade())
+            .and_then(|existing| existing.subscribe())
+        {
+            return stream;
+        }
+
+        let shared = Arc::new(SharedQuery::new(input.schema()));
+        let stream = shared
+            .subscribe()
+            .expect("new shared query accepts subscribers");
+        inflight.insert(key.clone(), Arc::downgrade(&shared));
+        drop(inflight);
+
+        let registry = self.clone();
+        tokio::spawn(async move {
+            let unregister = || registry.remove(&key, &shared);
+            shared.run(input, unregister).await;
+        });
+        stream
+    }
+
+    fn remove(&self, key: &str, shared: &Arc<SharedQuery>) {
+        let mut inflight = self.inflight.lock().unwrap();
+        let current = inflight
+            .get(key)
+            .map_or(false, |existing| existing.as_ptr() == Arc::as_ptr(shared));
+        if current {
+            inflight.remove(key);
+        }
+    }
+}
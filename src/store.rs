@@ -0,0 +1,86 @@
+use std::collections::hash_map::RandomState;
+use std::collections::HashMap;
+use std::hash::BuildHasher;
+use std::sync::RwLock;
+
+////////////////////////
+// Sharded string map //
+////////////////////////
+
+/* Concurrent map from string keys (session tokens, tickets) to values,
+ * split into independently locked shards so that lookups never contend on a
+ * global lock and inserts or sweeps only ever block the one shard they touch.
+ * Locks are only held for the duration of a single map operation and never
+ * across an await point, so plain std locks are used.
+ */
+
+pub struct ShardedMap<V> {
+    shards: Box<[RwLock<HashMap<String, V>>]>,
+    hasher: RandomState,
+}
+
+impl<V> ShardedMap<V> {
+    pub fn new() -> Self {
+        let parallelism = std::thread::available_parallelism().map_or(1, |n| n.get());
+        let num_shards = (4 * parallelism).next_power_of_two();
+        ShardedMap {
+            shards: (0..num_shards)
+                .map(|_| RwLock::new(HashMap::new()))
+                .collect(),
+            hasher: RandomState::new(),
+        }
+    }
+
+    fn shard(&self, key: &str) -> &RwLock<HashMap<String, V>> {
+        let hash = self.hasher.hash_one(key) as usize;
+        &self.shards[hash & (self.shards.len() - 1)]
+    }
+
+    pub fn insert(&self, key: String, value: V) -> Option<V> {
+        self.shard(&key).write().unwrap().insert(key, value)
+    }
+
+    // Look up the value for key and apply f to it under the shard's read lock
+    pub fn get_with<R>(&self, key: &str, f: impl FnOnce(&V) -> R) -> Option<R> {
+        self.shard(key).read().unwrap().get(key).map(f)
+    }
+
+    // Apply f to the whole shard of key under its write lock
+    pub fn update<R>(&self, key: &str, f: impl FnOnce(&mut HashMap<String, V>) -> R) -> R {
+        f(&mut self.shard(key).write().unwrap())
+    }
+
+    pub fn remove(&self, key: &str) -> Option<V> {
+        self.shard(key).write().unwrap().remove(key)
+    }
+
+    // Remove the entry for key only if f returns true for its value
+    pub fn remove_if(&self, key: &str, f: impl FnOnce(&V) -> bool) -> Option<V> {
+        let mut shard = self.shard(key).write().unwrap();
+        if shard.get(key).map_or(false, f) {
+            shard.remove(key)
+        } else {
+            None
+        }
+    }
+
+    // Retain only the entries for which f returns true, one shard at a time;
+    // returns the number of entries removed
+    pub fn retain(&self, mut f: impl FnMut(&String, &mut V) -> bool) -> usize {
+        let mut removed = 0;
+        for shard in self.shards.iter() {
+            let mut shard = shard.write().unwrap();
+            let before = shard.len();
+            shard.retain(|k, v| f(k, v));
+            removed += before - shard.len();
+        }
+        removed
+    }
+
+    pub fn len(&self) -> usize {
+        self.shards
+            .iter()
+            .map(|shard| shard.read().unwrap().len())
+            .sum()
+    }
+}
@@ -0,0 +1,401 @@
+use crate::alloc::{copy_batches, HugePages};
+use crate::numa::NumaPlacement;
+use crate::runtime::execute_on;
+use datafusion::arrow::datatypes::SchemaRef;
+use datafusion::arrow::record_batch::RecordBatch;
+use datafusion::datasource::TableProvider;
+use datafusion::error::{DataFusionError, Result};
+use datafusion::execution::context::{SessionState, TaskContext};
+use datafusion::logical_expr::TableType;
+use datafusion::physical_expr::PhysicalSortExpr;
+use datafusion::physical_plan::stream::RecordBatchStreamAdapter;
+use datafusion::physical_plan::{
+    DisplayFormatType, ExecutionPlan, Partitioning, SendableRecordBatchStream, Statistics,
+};
+use datafusion::prelude::Expr;
+use std::any::Any;
+use std::sync::atomic::{AtomicUsize, Ordering};
+use std::sync::Arc;
+use std::time::Instant;
+
+//////////////////
+// Cached table //
+//////////////////
+
+/* In-memory table holding the result of a SciDB query, split into
+ * partitions of fixed-size (zero-copy) slices of the loaded data.
+ *
+ * With shared scans enabled, concurrent scans of a partition cooperate in
+ * the manner of synchronized sequential scans: a scan that starts while
+ * another scan of the same partition is in progress begins at that scan's
+ * current batch and wraps around to read the batches it skipped. Concurrent
+ * queries therefore walk the partition together and touch each batch while
+ * it is still cache-resident, instead of each streaming the whole table
+ * through memory on its own. The order in which rows are produced varies
+ * between scans, which SQL permits in the absence of ORDER BY.
+ *
+ * Given a NUMA placement, each partition is copied into memory local to a
+ * node and scanned by that node's execution threads. Partitions may also be
+ * copied into huge-page-backed regions (see crate::alloc).
+ *
+ * Rows appended to a table by a refresh form partitions of their own, next
+ * to the shared partitions of its previous version.
+ */
+
+const BATCH_ROWS: usize = 8192;
+
+// How the partitions of cached tables are laid out in memory
+#[derive(Clone, Debug)]
+pub struct TableLayout {
+    pub target_partitions: usize,
+    pub placement: Option<Arc<NumaPlacement>>,
+    pub huge_pages: HugePages,
+}
+
+#[derive(Debug, Default)]
+struct ScanCursor {
+    // Index of the batch most recently read by any scan
+    position: AtomicUsize,
+    // Number of scans currently in progress
+    active: AtomicUsize,
+}
+
+#[derive(Debug)]
+struct CachedPartition {
+    batches: Vec<RecordBatch>,
+    cursor: ScanCursor,
+}
+
+impl CachedPartition {
+    fn new(batches: Vec<RecordBatch>) -> Self {
+        CachedPartition {
+            batches: batches,
+            cursor: ScanCursor::default(),
+        }
+    }
+}
+
+fn memory_size(data: &RecordBatch) -> usize {
+    data.columns()
+        .iter()
+        .map(|c| c.get_array_memory_size())
+        .sum()
+}
+
+// Distribute contiguous runs of batches of the data over partitions, the
+// first of which is the given partition of its table, and copy them into
+// the memory the layout asks for
+fn lay_out(
+    data: &RecordBatch,
+    first: usize,
+    layout: &TableLayout,
+) -> Result<Vec<Vec<RecordBatch>>> {
+    let num_rows = data.num_rows();
+    let num_batches = (num_rows + BATCH_ROWS - 1) / BATCH_ROWS;
+    let target_partitions = layout.target_partitions.max(1).min(num_batches.max(1));
+    let per_partition = (num_batches + target_partitions - 1) / target_partitions;
+    let mut partitions: Vec<Vec<RecordBatch>> = (0..target_partitions)
+        .map(|p| {
+            (p * per_partition..((p + 1) * per_partition).min(num_batches))
+                .map(|b| {
+                    let offset = b * BATCH_ROWS;
+                    data.slice(offset, BATCH_ROWS.min(num_rows - offset))
+                })
+                .collect()
+        })
+        .collect();
+    let copy = |batches: &[RecordBatch]| copy_batches(batches, layout.huge_pages);
+    if let Some(placement) = &layout.placement {
+        // Partitions are placed by their index in the whole table
+        let mut padded = vec![vec![]; first];
+        padded.append(&mut partitions);
+        partitions = placement
+            .place(padded, copy)
+            .map_err(DataFusionError::ArrowError)?
+            .split_off(first);
+    } else if layout.huge_pages != HugePages::Off {
+        partitions = partitions
+            .iter()
+            .map(|batches| copy(batches))
+            .collect::<std::result::Result<_, _>>()
+            .map_err(DataFusionError::ArrowError)?;
+    }
+    Ok(partitions)
+}
+
+pub struct CachedTable {
+    schema: SchemaRef,
+    partitions: Arc<Vec<CachedPartition>>,
+    shared_scan: bool,
+    placement: Option<Arc<NumaPlacement>>,
+    num_rows: usize,
+    num_bytes: usize,
+    loaded_at: Instant,
+}
+
+impl CachedTable {
+    pub fn new(data: RecordBatch, shared_scan: bool, layout: &TableLayout) -> Result<Self> {
+        let partitions = lay_out(&data, 0, layout)?
+            .into_iter()
+            .map(CachedPartition::new)
+            .collect();
+        Ok(CachedTable {
+            schema: data.schema(),
+            partitions: Arc::new(partitions),
+            shared_scan: shared_scan,
+            placement: layout.placement.clone(),
+            num_rows: data.num_rows(),
+            num_bytes: memory_size(&data),
+            loaded_at: Instant::now(),
+        })
+    }
+
+    // A table of the rows of this one followed by the given rows, sharing
+    // the batches of this table and laying the given rows out in partitions
+    // of their own
+    pub fn append(
+        &self,
+        data: RecordBatch,
+        shared_scan: bool,
+        layout: &TableLayout,
+    ) -> Result<Self> {
+        if data.schema() != self.schema {
+            return Err(DataFusionError::Plan(String::from(
+                "appended rows do not match the table's schema",
+            )));
+        }
+        let appended = match data.num_rows() {
+            0 => vec![],
+            _ => lay_out(&data, self.partitions.len(), layout)?,
+        };
+        let partitions = self
+            .partitions
+            .iter()
+            .map(|p| p.batches.clone())
+            .chain(appended)
+            .map(CachedPartition::new)
+            .collect();
+        Ok(CachedTable {
+            schema: self.schema.clone(),
+            partitions: Arc::new(partitions),
+            shared_scan: shared_scan,
+            placement: layout.placement.clone(),
+            num_rows: self.num_rows + data.num_rows(),
+            num_bytes: self.num_bytes + memory_size(&data),
+            loaded_at: Instant::now(),
+        })
+    }
+
+    pub fn num_rows(&self) -> usize {
+        self.num_rows
+    }
+
+    pub fn num_bytes(&self) -> usize {
+        self.num_bytes
+    }
+
+    // When the data of the table was last brought up to date
+    pub fn loaded_at(&self) -> Instant {
+        self.loaded_at
+    }
+
+    pub fn num_partitions(&self) -> usize {
+        self.partitions.len()
+    }
+
+    // The batches of the table, in the order of its rows
+    pub fn batches(&self) -> impl Iterator<Item = &RecordBatch> {
+        self.partitions.iter().flat_map(|p| p.batches.iter())
+    }
+
+    fn table_statistics(&self) -> Statistics {
+        Statistics {
+            num_rows: Some(self.num_rows),
+            total_byte_size: Some(self.num_bytes),
+            column_statistics: None,
+            is_exact: true,
+        }
+    }
+}
+
+#[tonic::async_trait]
+impl TableProvider for CachedTable {
+    fn as_any(&self) -> &dyn Any {
+        self
+    }
+
+    fn schema(&self) -> SchemaRef {
+        self.schema.clone()
+    }
+
+    fn table_type(&self) -> TableType {
+        TableType::Base
+    }
+
+    async fn scan(
+        &self,
+        _state: &SessionState,
+        projection: Option<&Vec<usize>>,
+        _filters: &[Expr],
+        _limit: Option<usize>,
+    ) -> Result<Arc<dyn ExecutionPlan>> {
+        let schema = match projection {
+            Some(indices) => Arc::new(self.schema.project(indices)?),
+            None => self.schema.clone(),
+        };
+        Ok(Arc::new(CachedTableExec {
+            schema: schema,
+            partitions: self.partitions.clone(),
+            projection: projection.cloned(),
+            shared_scan: self.shared_scan,
+            placement: self.placement.clone(),
+            statistics: self.table_statistics(),
+        }))
+    }
+
+    fn statistics(&self) -> Option<Statistics> {
+        Some(self.table_statistics())
+    }
+}
+
+////////////////////////////////
+// Cached table scan operator //
+////////////////////////////////
+
+pub struct CachedTableExec {
+    schema: SchemaRef,
+    partitions: Arc<Vec<CachedPartition>>,
+    projection: Option<Vec<usize>>,
+    shared_scan: bool,
+    placement: Option<Arc<NumaPlacement>>,
+    statistics: Statistics,
+}
+
+impl std::fmt::Debug for CachedTableExec {
+    fn fmt(&self, f: &mut std::fmt::Formatter<'_>) -> std::fmt::Result {
+        f.debug_struct("CachedTableExec")
+            .field("partitions", &self.partitions.len())
+            .field("projection", &self.projection)
+            .field("shared_scan", &self.shared_scan)
+            .finish()
+    }
+}
+
+// Unregisters a scan from its partition cursor when the scan stream is dropped
+struct ActiveScan {
+    partitions: Arc<Vec<CachedPartition>>,
+    partition: usize,
+}
+
+impl Drop for ActiveScan {
+    fn drop(&mut self) {
+        self.partitions[self.partition]
+            .cursor
+            .active
+            .fetch_sub(1, Ordering::AcqRel);
+    }
+}
+
+impl ExecutionPlan for CachedTableExec {
+    fn as_any(&self) -> &dyn Any {
+        self
+    }
+
+    fn schema(&self) -> SchemaRef {
+        self.schema.clone()
+    }
+
+    fn output_partitioning(&self) -> Partitioning {
+        Partitioning::UnknownPartitioning(self.partitions.len())
+    }
+
+    fn output_ordering(&self) -> Option<&[PhysicalSortExpr]> {
+        None
+    }
+
+    fn children(&self) -> Vec<Arc<dyn ExecutionPlan>> {
+        vec![]
+    }
+
+    fn with_new_children(
+        self: Arc<Self>,
+        _children: Vec<Arc<dyn ExecutionPlan>>,
+    ) -> Result<Arc<dyn ExecutionPlan>> {
+        Ok(self)
+    }
+
+    fn execute(
+        &self,
+        partition: usize,
+        _context: Arc<TaskContext>,
+    ) -> Result<SendableRecordBatchStream> {
+        let cursor = &self.partitions[partition].cursor;
+        let num_batches = self.partitions[partition].batches.len();
+
+        // Attach to a scan in progress, or start from the beginning
+        let in_progress = cursor.active.fetch_add(1, Ordering::AcqRel);
+        let start = if self.shared_scan && in_progress > 0 {
+            cursor.position.load(Ordering::Acquire)
+        } else {
+            0
+        };
+        let scan = ActiveScan {
+            partitions: self.partitions.clone(),
+            partition: partition,
+        };
+
+        let shared_scan = self.shared_scan;
+        let projection = self.projection.clone();
+        let stream = futures::stream::unfold((scan, 0), move |(scan, read)| {
+            let projection = projection.clone();
+            async move {
+                if read == num_batches {
+                    return None;
+                }
+                let index = (start + read) % num_batches;
+                let part = &scan.partitions[scan.partition];
+                if shared_scan {
+                    part.cursor.position.store(index, Ordering::Release);
+                }
+                let batch = &part.batches[index];
+                let batch = match &projection {
+                    Some(indices) => batch.project(indices).map_err(DataFusionError::ArrowError),
+                    None => Ok(batch.clone()),
+                };
+                Some((batch, (scan, read + 1)))
+            }
+        });
+        let stream = Box::pin(RecordBatchStreamAdapter::new(self.schema.clone(), stream));
+
+        // Drive the scan on the execution threads of the partition's node
+        match &self.placement {
+            Some(placement) => {
+                let handle = &placement.handles[placement.node_of(partition)];
+                Ok(execute_on(handle, self.schema.clone(), move || {
+                    Box::pin(async move { Ok(stream as SendableRecordBatchStream) })
+                }))
+            }
+            None => Ok(stream),
+        }
+    }
+
+    fn fmt_as(&self, _t: DisplayFormatType, f: &mut std::fmt::Formatter) -> std::fmt::Result {
+        write!(
+            f,
+            "CachedTableExec: partitions={}, shared_scan={}",
+            self.partitions.len(),
+            self.shared_scan
+        )
+    }
+
+    fn statistics(&self) -> Statistics {
+        if self.projection.is_some() {
+            Statistics {
+                num_rows: self.statistics.num_rows,
+                ..Default::default()
+            }
+        } else {
+            self.statistics.clone()
+        }
+    }
+}
@@ -0,0 +1,194 @@
+use crate::flight::SessionType;
+use base64::{engine::general_purpose::URL_SAFE_NO_PAD, Engine as _};
+use hmac::{Hmac, Mac};
+use serde::{Deserialize, Serialize};
+use sha2::Sha256;
+use std::time::{Duration, SystemTime, UNIX_EPOCH};
+
+///////////////////////////
+// Signed session tokens //
+///////////////////////////
+
+/* Stateless session tokens carry their own claims and are authenticated
+ * with an HMAC-SHA256 over a server key, so that any replica holding the
+ * key set can validate them without a shared session map:
+ *
+ *   v1.<key id>.<base64url claims>.<base64url mac>
+ *
+ * The claims are the username, session type, issue time and expiry time in
+ * seconds since the epoch, separated by newlines. The first key of the key
+ * set signs new tokens; every key in the set is accepted for validation, so
+ * keys can be rolled over by prepending a new key and dropping the old one
+ * once the tokens it signed have expired.
+ */
+
+type HmacSha256 = Hmac<Sha256>;
+
+const TOKEN_VERSION: &str = "v1";
+const MIN_SECRET_LEN: usize = 32;
+
+// Key file format
+#[derive(Serialize, Deserialize, Debug)]
+struct TokenKey {
+    id: String,
+    secret: String,
+}
+
+#[derive(Serialize, Deserialize, Debug)]
+struct TokenKeyFile {
+    keys: Vec<TokenKey>,
+}
+
+#[derive(Debug)]
+pub enum TokenError {
+    Malformed,
+    UnknownKey,
+    BadSignature,
+    Expired,
+}
+
+impl std::fmt::Display for TokenError {
+    fn fmt(&self, f: &mut std::fmt::Formatter<'_>) -> std::fmt::Result {
+        match &self {
+            TokenError::Malformed => write!(f, "malformed session token"),
+            TokenError::UnknownKey => write!(f, "session token signed with unknown key"),
+            TokenError::BadSignature => write!(f, "invalid session token signature"),
+            TokenError::Expired => write!(f, "expired session token"),
+        }
+    }
+}
+
+impl std::error::Error for TokenError {}
+
+pub struct TokenClaims {
+    pub username: String,
+    pub session_type: SessionType,
+    pub issued: u64,
+    pub expires: u64,
+}
+
+impl TokenClaims {
+    // Time left until the token expires
+    pub fn remaining(&self) -> Duration {
+        Duration::from_secs(self.expires.saturating_sub(unix_now()))
+    }
+}
+
+pub struct TokenKeySet {
+    keys: Vec<(String, Vec<u8>)>,
+}
+
+fn unix_now() -> u64 {
+    SystemTime::now()
+        .duration_since(UNIX_EPOCH)
+        .map_or(0, |d| d.as_secs())
+}
+
+impl TokenKeySet {
+    pub fn from_file(path: &std::path::Path) -> Result<TokenKeySet, Box<dyn std::error::Error>> {
+        let keyf = std::fs::File::open(path)?;
+        let keyfile: TokenKeyFile = serde_yaml::from_reader(keyf)?;
+        if keyfile.keys.is_empty() {
+            return Err("token key file contains no keys".into());
+        }
+        for key in keyfile.keys.iter() {
+            if key.id.is_empty() || key.id.contains('.') {
+                return Err(format!("invalid token key id '{}'", key.id).into());
+            }
+            if key.secret.len() < MIN_SECRET_LEN {
+                return Err(format!(
+                    "token key '{}' must be at least {MIN_SECRET_LEN} bytes",
+                    key.id
+                )
+                .into());
+            }
+        }
+        Ok(TokenKeySet {
+            keys: keyfile
+                .keys
+                .into_iter()
+                .map(|key| (key.id, key.secret.into_bytes()))
+                .collect(),
+        })
+    }
+
+    fn mac(secret: &[u8], signed: &str) -> HmacSha256 {
+        let mut mac = HmacSha256::new_from_slice(secret).expect("HMAC accepts keys of any size");
+        mac.update(signed.as_bytes());
+        mac
+    }
+
+    pub fn is_signed_token(token: &str) -> bool {
+        token.starts_with(TOKEN_VERSION) && token[TOKEN_VERSION.len()..].starts_with('.')
+    }
+
+    pub fn sign(&self, username: &str, session_type: SessionType, lifetime: Duration) -> String {
+        let (kid, secret) = &self.keys[0];
+        let issued = unix_now();
+        let session_type = match session_type {
+            SessionType::Admin => "admin",
+            _ => "regular",
+        };
+        let claims = format!(
+            "{username}\n{session_type}\n{issued}\n{}",
+            issued + lifetime.as_secs()
+        );
+        let signed = format!(
+            "{TOKEN_VERSION}.{kid}.{}",
+            URL_SAFE_NO_PAD.encode(claims.as_bytes())
+        );
+        let tag = TokenKeySet::mac(secret, &signed).finalize().into_bytes();
+        format!("{signed}.{}", URL_SAFE_NO_PAD.encode(tag))
+    }
+
+    pub fn verify(&self, token: &str) -> Result<TokenClaims, TokenError> {
+        let (signed, tag) = token.rsplit_once('.').ok_or(TokenError::Malformed)?;
+        let mut parts = signed.splitn(3, '.');
+        let (version, kid, claims) = match (parts.next(), parts.next(), parts.next()) {
+            (Some(version), Some(kid), Some(claims)) => (version, kid, claims),
+            _ => return Err(TokenError::Malformed),
+        };
+        if version != TOKEN_VERSION {
+            return Err(TokenError::Malformed);
+        }
+
+        // Authenticate before interpreting any of the claims
+        let (_, secret) = self
+            .keys
+            .iter()
+            .find(|(id, _)| id == kid)
+            .ok_or(TokenError::UnknownKey)?;
+        let tag = URL_SAFE_NO_PAD
+            .decode(tag)
+            .map_err(|_| TokenError::Malformed)?;
+        TokenKeySet::mac(secret, signed)
+            .verify_slice(&tag)
+            .map_err(|_| TokenError::BadSignature)?;
+
+        let claims = URL_SAFE_NO_PAD
+            .decode(claims)
+            .map_err(|_| TokenError::Malformed)?;
+        let claims = String::from_utf8(claims).map_err(|_| TokenError::Malformed)?;
+        let fields: Vec<&str> = claims.split('\n').collect();
+        let (username, session_type, issued, expires) = match fields[..] {
+            [username, session_type, issued, expires] => (username, session_type, issued, expires),
+            _ => return Err(TokenError::Malformed),
+        };
+        let session_type = match session_type {
+            "admin" => SessionType::Admin,
+            "regular" => SessionType::Regular,
+            _ => return Err(TokenError::Malformed),
+        };
+        let issued: u64 = issued.parse().map_err(|_| TokenError::Malformed)?;
+        let expires: u64 = expires.parse().map_err(|_| TokenError::Malformed)?;
+        if unix_now() > expires {
+            return Err(TokenError::Expired);
+        }
+        Ok(TokenClaims {
+            username: username.to_string(),
+            session_type: session_type,
+            issued: issued,
+            expires: expires,
+        })
+    }
+}
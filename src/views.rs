@@ -0,0 +1,698 @@
+use crate::runtime::ServiceRuntimes;
+use crate::scidb::CellChecksum;
+use crate::table::{CachedTable, TableLayout};
+use datafusion::arrow::array::as_primitive_array;
+use datafusion::arrow::compute::{self, concat_batches};
+use datafusion::arrow::datatypes::{DataType, Int64Type, Schema, SchemaRef};
+use datafusion::arrow::record_batch::RecordBatch;
+use datafusion::common::Column;
+use datafusion::datasource::{source_as_provider, MemTable, TableProvider};
+use datafusion::error::{DataFusionError, Result};
+use datafusion::logical_expr::expr::AggregateFunction as AggregateCall;
+use datafusion::logical_expr::{AggregateFunction, JoinType, LogicalPlan};
+use datafusion::prelude::*;
+use datafusion::sql::parser::{DFParser, Statement as DFStatement};
+use datafusion::sql::sqlparser::ast::Statement as SQLStatement;
+use serde::{Deserialize, Serialize};
+use std::collections::{HashMap, HashSet};
+use std::sync::Arc;
+
+////////////////////////
+// Materialized views //
+////////////////////////
+
+/* Views are named SQL queries over the tables of a context, executed once
+ * when the context is built and registered as cached tables in their own
+ * right, so that queries read their precomputed rows instead of repeating
+ * the same joins and aggregations on every request. Views may read other
+ * views: they are materialized in waves, each wave executing in parallel
+ * all the remaining views whose tables are all registered by then.
+ *
+ * A refresh maintains views incrementally where it can. Tables whose
+ * previous rows are unchanged, in the same order, are noted with the rows
+ * appended to them since the previous refresh; arrays growing along a
+ * dimension have only the rows past their watermark, the highest
+ * coordinate loaded along it, fetched and appended in the first place. A
+ * view whose tables are all unchanged keeps its previous rows. A view
+ * reading, once, a single table that gained rows is computed from those
+ * rows alone when it is made of projections, filters and inner joins with
+ * unchanged tables, optionally under a final grouping by SUM, COUNT, MIN
+ * and MAX aggregates: its new rows are appended to its previous ones, or
+ * its new groups merged into its previous groups. Any other view is
+ * recomputed in full. A table reloaded on its own has the views reading it
+ * brought up to date with it.
+ */
+
+#[derive(Serialize, Deserialize, Clone, Debug)]
+pub struct ViewDefinition {
+    pub name: String,
+    pub sql: String,
+    #[serde(default)]
+    pub shared_scan: bool,
+}
+
+// A table registered by a refresh, with the definition it was computed from
+// and, if it only gained rows since the previous refresh, the rows it gained
+#[derive(Clone)]
+struct MaterializedTable {
+    definition: String,
+    table: Arc<CachedTable>,
+    appended: Option<RecordBatch>,
+    // The dimension an array grows along, the highest coordinate loaded, and
+    // the checksum of the cells up to it
+    append_on: Option<String>,
+    watermark: Option<i64>,
+    checksum: Option<CellChecksum>,
+}
+
+// The arrays and views registered by a refresh, from which the next refresh
+// maintains its views
+#[derive(Clone, Default)]
+pub struct Materialized {
+    tables: HashMap<String, MaterializedTable>,
+}
+
+impl Materialized {
+    // Register an array loaded in full, noting the rows appended to it when
+    // its previous version is a prefix of it
+    pub fn register_array(
+        &mut self,
+        ctx: &SessionContext,
+        name: &str,
+        definition: &str,
+        append_on: Option<&str>,
+        data: RecordBatch,
+        shared_scan: bool,
+        layout: &TableLayout,
+        previous: &Materialized,
+    ) -> Result<()> {
+        let appended = previous
+            .tables
+            .get(name)
+            .filter(|old| old.definition == definition)
+            .and_then(|old| appended_rows(&old.table, &data));
+        let watermark = match append_on {
+            Some(dimension) => max_coordinate(&data, dimension)?,
+            None => None,
+        };
+        let table = MaterializedTable {
+            definition: definition.to_string(),
+            table: Arc::new(CachedTable::new(data, shared_scan, layout)?),
+            appended: appended,
+            append_on: append_on.map(String::from),
+            watermark: watermark,
+            checksum: None,
+        };
+        self.register(ctx, name, table)
+    }
+
+    // The watermark of an array loaded by the previous refresh along the
+    // given dimension, with the checksum of the cells loaded up to it if
+    // one was computed
+    pub fn watermark(
+        &self,
+        name: &str,
+        definition: &str,
+        dimension: &str,
+    ) -> Option<(i64, Option<CellChecksum>)> {
+        let old = self.tables.get(name)?;
+        if old.definition != definition || old.append_on.as_deref() != Some(dimension) {
+            return None;
+        }
+        Some((old.watermark?, old.checksum))
+    }
+
+    // The highest coordinate loaded of an array registered by this refresh
+    pub fn loaded_watermark(&self, name: &str) -> Option<i64> {
+        self.tables.get(name)?.watermark
+    }
+
+    // Record the checksum of the cells of an array up to its watermark
+    pub fn set_checksum(&mut self, name: &str, checksum: CellChecksum) {
+        if let Some(table) = self.tables.get_mut(name) {
+            table.checksum = Some(checksum);
+        }
+    }
+
+    // Register an array of which only the rows past its previous watermark
+    // were fetched, appending them to its previous version; once its
+    // partitions grow to twice the target number, they are compacted back
+    // into evenly sized ones
+    pub fn append_array(
+        &mut self,
+        ctx: &SessionContext,
+        name: &str,
+        data: Vec<RecordBatch>,
+        shared_scan: bool,
+        layout: &TableLayout,
+        previous: &Materialized,
+    ) -> Result<()> {
+        let old = previous.tables.get(name).ok_or_else(|| {
+            DataFusionError::Plan(format!("array {name} has no rows to append to"))
+        })?;
+        let schema = old.table.schema();
+        let rows = concat_batches(&schema, &data)?;
+        let watermark = match &old.append_on {
+            Some(dimension) => max_coordinate(&rows, dimension)?.max(old.watermark),
+            None => None,
+        };
+        let table = if old.table.num_partitions() >= 2 * layout.target_partitions.max(1) {
+            let mut batches: Vec<RecordBatch> = old.table.batches().cloned().collect();
+            batches.push(rows.clone());
+            CachedTable::new(concat_batches(&schema, &batches)?, shared_scan, layout)?
+        } else {
+            old.table.append(rows.clone(), shared_scan, layout)?
+        };
+        let table = MaterializedTable {
+            definition: old.definition.clone(),
+            table: Arc::new(table),
+            appended: Some(rows),
+            append_on: old.append_on.clone(),
+            watermark: watermark,
+            checksum: None,
+        };
+        self.register(ctx, name, table)
+    }
+
+    // Forget the rows appended by this refresh, which only its own views
+    // read, and which may hold on to the whole data an array was loaded from
+    pub fn settle(mut self) -> Self {
+        for table in self.tables.values_mut() {
+            table.appended = None;
+        }
+        self
+    }
+
+    fn register(
+        &mut self,
+        ctx: &SessionContext,
+        name: &str,
+        table: MaterializedTable,
+    ) -> Result<()> {
+        ctx.register_table(name, table.table.clone())?;
+        self.tables.insert(name.to_string(), table);
+        Ok(())
+    }
+
+    // The tables of a refresh, registered into a context as unchanged since,
+    // from which to reload one of them on its own
+    pub fn reopen(&self, ctx: &SessionContext) -> Result<Materialized> {
+        let mut reopened = Materialized::default();
+        for (name, table) in &self.tables {
+            let mut table = table.clone();
+            table.appended = Some(RecordBatch::new_empty(table.table.schema()));
+            reopened.register(ctx, name, table)?;
+        }
+        Ok(reopened)
+    }
+
+    // The table registered under a name
+    pub fn table(&self, name: &str) -> Option<Arc<CachedTable>> {
+        self.tables.get(name).map(|t| t.table.clone())
+    }
+
+    fn register_view(
+        &mut self,
+        ctx: &SessionContext,
+        view: &ViewDefinition,
+        table: Arc<CachedTable>,
+        appended: Option<RecordBatch>,
+    ) -> Result<()> {
+        let table = MaterializedTable {
+            definition: view.sql.clone(),
+            table: table,
+            appended: appended,
+            append_on: None,
+            watermark: None,
+            checksum: None,
+        };
+        self.register(ctx, &view.name, table)
+    }
+}
+
+// The highest coordinate of the rows along a dimension, exposed as a column
+fn max_coordinate(data: &RecordBatch, dimension: &str) -> Result<Option<i64>> {
+    let column = data.column(data.schema().index_of(dimension)?);
+    let column = compute::cast(column, &DataType::Int64)?;
+    Ok(compute::max(as_primitive_array::<Int64Type>(&column)))
+}
+
+// The rows following those of the previous version of a table, if they are
+// all still there, in the same order
+fn appended_rows(previous: &CachedTable, data: &RecordBatch) -> Option<RecordBatch> {
+    if data.schema() != previous.schema() || data.num_rows() < previous.num_rows() {
+        return None;
+    }
+    let mut offset = 0;
+    for batch in previous.batches() {
+        if data.slice(offset, batch.num_rows()) != *batch {
+            return None;
+        }
+        offset += batch.num_rows();
+    }
+    Some(data.slice(offset, data.num_rows() - offset))
+}
+
+// Reject anything but a single query, which DataFusion would otherwise
+// execute while planning it
+fn check_query(view: &ViewDefinition) -> Result<()> {
+    let statements = DFParser::parse_sql(&view.sql)
+        .map_err(|e| DataFusionError::Plan(format!("view {}: {e}", view.name)))?;
+    match statements.iter().collect::<Vec<_>>().as_slice() {
+        [DFStatement::Statement(statement)] if matches!(**statement, SQLStatement::Query(_)) => {
+            Ok(())
+        }
+        _ => Err(DataFusionError::Plan(format!(
+            "view {} must be a single query",
+            view.name
+        ))),
+    }
+}
+
+// Materialize the views into the context, spreading each wave over the
+// execution runtimes, and return how many were maintained incrementally
+pub async fn materialize_views(
+    ctx: &SessionContext,
+    views: &[ViewDefinition],
+    layout: &TableLayout,
+    runtimes: &ServiceRuntimes,
+    previous: &Materialized,
+    current: &mut Materialized,
+) -> Result<usize> {
+    for view in views {
+        check_query(view)?;
+    }
+    let mut maintained = 0;
+    let mut pending: Vec<&ViewDefinition> = views.iter().collect();
+    while !pending.is_empty() {
+        // Views that plan have all their tables in place; the others wait
+        // for a later wave
+        let mut wave = vec![];
+        let mut blocked = vec![];
+        let mut first_error = None;
+        for view in pending {
+            match ctx.sql(&view.sql).await {
+                Ok(df) => wave.push((view, df)),
+                Err(e) => {
+                    first_error.get_or_insert(e);
+                    blocked.push(view);
+                }
+            }
+        }
+        // A wave that materializes nothing means a view reads a table that
+        // will never exist, or is otherwise invalid
+        if wave.is_empty() {
+            let names: Vec<&str> = blocked.iter().map(|view| view.name.as_str()).collect();
+            return Err(DataFusionError::Plan(format!(
+                "views {} could not be planned: {}",
+                names.join(", "),
+                first_error.unwrap()
+            )));
+        }
+
+        let mut tasks = vec![];
+        for (view, df) in wave {
+            let schema: Schema = df.schema().into();
+            let schema = Arc::new(schema);
+            let task = match plan_refresh(ctx, view, &df, previous, current)? {
+                Refresh::Keep(table) => {
+                    // Still up to date as of this refresh
+                    let appended = RecordBatch::new_empty(table.schema());
+                    let table = table.append(appended.clone(), view.shared_scan, layout)?;
+                    current.register_view(ctx, view, Arc::new(table), Some(appended))?;
+                    maintained += 1;
+                    continue;
+                }
+                Refresh::Update {
+                    previous,
+                    table,
+                    appended,
+                    shape,
+                } => {
+                    let delta = delta_context(ctx, current, &table, appended)?;
+                    let sql = view.sql.clone();
+                    runtimes.exec().spawn(async move {
+                        // Fall back to recomputing the view should its
+                        // updated rows not fit its previous ones
+                        match update(&delta, &sql, &previous, shape).await {
+                            Ok(rows) => Ok(rows),
+                            Err(_) => recompute(df, schema).await,
+                        }
+                    })
+                }
+                Refresh::Recompute => runtimes.exec().spawn(recompute(df, schema)),
+            };
+            tasks.push((view, task));
+        }
+        for (view, task) in tasks {
+            let rows = task
+                .await
+                .map_err(|e| DataFusionError::Execution(e.to_string()))??;
+            if rows.incremental {
+                maintained += 1;
+            }
+            let table = Arc::new(CachedTable::new(rows.data, view.shared_scan, layout)?);
+            current.register_view(ctx, view, table, rows.appended)?;
+        }
+        pending = blocked;
+    }
+    Ok(maintained)
+}
+
+// Bring up to date the views reading, directly or through other views, a
+// table reloaded on its own, and return their names. The context and the
+// current tables hold all the tables of the previous refresh, the reloaded
+// one in its new version
+pub async fn rematerialize_dependents(
+    ctx: &SessionContext,
+    views: &[ViewDefinition],
+    table: &str,
+    layout: &TableLayout,
+    runtimes: &ServiceRuntimes,
+    previous: &Materialized,
+    current: &mut Materialized,
+) -> Result<Vec<String>> {
+    let mut reads = Vec::with_capacity(views.len());
+    for view in views {
+        let df = ctx.sql(&view.sql).await?;
+        let plan = ctx.state().optimize(df.logical_plan())?;
+        reads.push(scanned_tables(&plan, current));
+    }
+    // Views reading anything but arrays and views are taken to depend on
+    // the table too
+    let mut changed = HashSet::from([table.to_string()]);
+    let mut dependents = vec![];
+    loop {
+        let before = dependents.len();
+        for (view, reads) in views.iter().zip(&reads) {
+            let depends = match reads {
+                Some(names) => names.iter().any(|name| changed.contains(name)),
+                None => true,
+            };
+            if depends && changed.insert(view.name.clone()) {
+                dependents.push(view.clone());
+            }
+        }
+        if dependents.len() == before {
+            break;
+        }
+    }
+    // Dependents are planned anew in waves, once the views they read are
+    // registered again
+    for view in &dependents {
+        ctx.deregister_table(view.name.as_str())?;
+    }
+    materialize_views(ctx, &dependents, layout, runtimes, previous, current).await?;
+    Ok(dependents.into_iter().map(|view| view.name).collect())
+}
+
+//////////////////////////////////
+// Incremental view maintenance //
+//////////////////////////////////
+
+// How a view is brought up to date
+enum Refresh {
+    // None of its tables changed: keep its previous rows
+    Keep(Arc<CachedTable>),
+    // One of its tables only gained rows: update its previous rows from them
+    Update {
+        previous: Arc<CachedTable>,
+        table: String,
+        appended: RecordBatch,
+        shape: Shape,
+    },
+    Recompute,
+}
+
+// Views whose rows can be updated from the rows appended to a table
+enum Shape {
+    // Projections, filters and inner joins, whose rows grow by their rows
+    // over the appended rows
+    Linear,
+    // A grouping over a linear input, with how each column merges groups
+    Aggregate(Vec<Merge>),
+}
+
+enum Merge {
+    Key,
+    Sum,
+    Min,
+    Max,
+}
+
+struct ViewRows {
+    data: RecordBatch,
+    // The rows appended to the view, if it only gained rows
+    appended: Option<RecordBatch>,
+    incremental: bool,
+}
+
+fn plan_refresh(
+    ctx: &SessionContext,
+    view: &ViewDefinition,
+    df: &DataFrame,
+    previous: &Materialized,
+    current: &Materialized,
+) -> Result<Refresh> {
+    let old = match previous.tables.get(&view.name) {
+        Some(old) if old.definition == view.sql => old,
+        _ => return Ok(Refresh::Recompute),
+    };
+    let plan = ctx.state().optimize(df.logical_plan())?;
+    let scanned = match scanned_tables(&plan, current) {
+        Some(scanned) => scanned,
+        None => return Ok(Refresh::Recompute),
+    };
+    let mut changed = vec![];
+    for name in scanned {
+        match &current.tables[&name].appended {
+            Some(rows) if rows.num_rows() == 0 => {}
+            Some(rows) => changed.push((name, rows.clone())),
+            None => return Ok(Refresh::Recompute),
+        }
+    }
+    // A table scanned more than once, as in a self join, gains rows
+    // combining its appended rows with each other
+    if changed.len() > 1 {
+        return Ok(Refresh::Recompute);
+    }
+    match (changed.pop(), view_shape(&plan)) {
+        (None, _) => Ok(Refresh::Keep(old.table.clone())),
+        (Some((table, appended)), Some(shape)) => Ok(Refresh::Update {
+            previous: old.table.clone(),
+            table: table,
+            appended: appended,
+            shape: shape,
+        }),
+        (Some(_), None) => Ok(Refresh::Recompute),
+    }
+}
+
+// The names of the tables a plan scans, once per scan, or None if it scans
+// anything but registered arrays and views
+fn scanned_tables(plan: &LogicalPlan, current: &Materialized) -> Option<Vec<String>> {
+    let mut names = vec![];
+    let mut plans = vec![plan];
+    while let Some(plan) = plans.pop() {
+        if let LogicalPlan::TableScan(scan) = plan {
+            let provider = source_as_provider(&scan.source).ok()?;
+            let provider = Arc::as_ptr(&provider) as *const u8;
+            let (name, _) = current
+                .tables
+                .iter()
+                .find(|(_, t)| Arc::as_ptr(&t.table) as *const u8 == provider)?;
+            names.push(name.clone());
+        }
+        plans.extend(plan.inputs());
+    }
+    Some(names)
+}
+
+fn linear(plan: &LogicalPlan) -> bool {
+    match plan {
+        LogicalPlan::Projection(projection) => linear(&projection.input),
+        LogicalPlan::Filter(filter) => linear(&filter.input),
+        LogicalPlan::SubqueryAlias(alias) => linear(&alias.input),
+        LogicalPlan::Join(join) => {
+            join.join_type == JoinType::Inner && linear(&join.left) && linear(&join.right)
+        }
+        LogicalPlan::CrossJoin(join) => linear(&join.left) && linear(&join.right),
+        LogicalPlan::TableScan(scan) => scan.fetch.is_none(),
+        _ => false,
+    }
+}
+
+fn unalias(expr: &Expr) -> &Expr {
+    match expr {
+        Expr::Alias(inner, _) => unalias(inner),
+        _ => expr,
+    }
+}
+
+fn view_shape(plan: &LogicalPlan) -> Option<Shape> {
+    let (columns, aggregate) = match plan {
+        LogicalPlan::Projection(projection) => match projection.input.as_ref() {
+            LogicalPlan::Aggregate(aggregate) => {
+                let columns = projection.expr.iter().map(|expr| match unalias(expr) {
+                    Expr::Column(column) => Some(column.clone()),
+                    _ => None,
+                });
+                (columns.collect::<Option<Vec<_>>>()?, aggregate)
+            }
+            _ => return linear(plan).then_some(Shape::Linear),
+        },
+        LogicalPlan::Aggregate(aggregate) => {
+            let fields = aggregate.schema.fields().iter();
+            (fields.map(|f| f.qualified_column()).collect(), aggregate)
+        }
+        _ => return linear(plan).then_some(Shape::Linear),
+    };
+    let grouping_sets = aggregate
+        .group_expr
+        .iter()
+        .any(|expr| matches!(expr, Expr::GroupingSet(_)));
+    if grouping_sets || !linear(&aggregate.input) {
+        return None;
+    }
+
+    // Every column must be a group key or a distributive aggregate
+    let keys = aggregate.group_expr.len();
+    let mut grouped = vec![false; keys];
+    let mut merges = Vec::with_capacity(columns.len());
+    for column in columns {
+        let index = aggregate.schema.index_of_column(&column).ok()?;
+        if index < keys {
+            grouped[index] = true;
+            merges.push(Merge::Key);
+            continue;
+        }
+        let merge = match unalias(&aggregate.aggr_expr[index - keys]) {
+            Expr::AggregateFunction(AggregateCall {
+                fun,
+                distinct: false,
+                filter: None,
+                ..
+            }) => match fun {
+                AggregateFunction::Sum | AggregateFunction::Count => Merge::Sum,
+                AggregateFunction::Min => Merge::Min,
+                AggregateFunction::Max => Merge::Max,
+                _ => return None,
+            },
+            _ => return None,
+        };
+        merges.push(merge);
+    }
+    // Groups can only be merged if the view keeps all their keys
+    grouped
+        .iter()
+        .all(|g| *g)
+        .then_some(Shape::Aggregate(merges))
+}
+
+// A context in which the changed table holds only its appended rows, while
+// every other table is the same as in the refreshed context
+fn delta_context(
+    ctx: &SessionContext,
+    current: &Materialized,
+    changed: &str,
+    appended: RecordBatch,
+) -> Result<SessionContext> {
+    let delta = SessionContext::with_config_rt(ctx.copied_config(), ctx.runtime_env());
+    for (name, t) in &current.tables {
+        if name == changed {
+            let rows = MemTable::try_new(appended.schema(), vec![vec![appended.clone()]])?;
+            delta.register_table(name.as_str(), Arc::new(rows))?;
+        } else {
+            delta.register_table(name.as_str(), t.table.clone())?;
+        }
+    }
+    Ok(delta)
+}
+
+async fn recompute(df: DataFrame, schema: SchemaRef) -> Result<ViewRows> {
+    let batches = df.collect().await?;
+    Ok(ViewRows {
+        data: concat_batches(&schema, &batches)?,
+        appended: None,
+        incremental: false,
+    })
+}
+
+// Batches computed by a query, as batches of the view's schema
+fn conform(schema: &SchemaRef, batches: Vec<RecordBatch>) -> Result<Vec<RecordBatch>> {
+    batches
+        .into_iter()
+        .map(|batch| {
+            RecordBatch::try_new(schema.clone(), batch.columns().to_vec())
+                .map_err(DataFusionError::ArrowError)
+        })
+        .collect()
+}
+
+async fn update(
+    delta: &SessionContext,
+    sql: &str,
+    previous: &CachedTable,
+    shape: Shape,
+) -> Result<ViewRows> {
+    let schema = previous.schema();
+    let rows = conform(&schema, delta.sql(sql).await?.collect().await?)?;
+    match shape {
+        Shape::Linear => {
+            let appended = concat_batches(&schema, &rows)?;
+            let mut batches: Vec<RecordBatch> = previous.batches().cloned().collect();
+            batches.push(appended.clone());
+            Ok(ViewRows {
+                data: concat_batches(&schema, &batches)?,
+                appended: Some(appended),
+                incremental: true,
+            })
+        }
+        Shape::Aggregate(merges) => {
+            let mut batches: Vec<RecordBatch> = previous.batches().cloned().collect();
+            batches.extend(rows);
+            Ok(ViewRows {
+                data: merge_groups(delta, &schema, batches, &merges).await?,
+                appended: None,
+                incremental: true,
+            })
+        }
+    }
+}
+
+// Aggregate the previous groups of a view together with its groups over the
+// appended rows, casting the merged aggregates back to the view's types
+async fn merge_groups(
+    ctx: &SessionContext,
+    schema: &SchemaRef,
+    batches: Vec<RecordBatch>,
+    merges: &[Merge],
+) -> Result<RecordBatch> {
+    let groups = ctx.read_table(Arc::new(MemTable::try_new(schema.clone(), vec![batches])?))?;
+    let column = |name: &str| Expr::Column(Column::from_name(name));
+    let merged = |i: usize| format!("merged_{i}");
+    let mut keys = vec![];
+    let mut aggregates = vec![];
+    let mut output = vec![];
+    for (i, merge) in merges.iter().enumerate() {
+        let field = schema.field(i);
+        let value = column(field.name());
+        match merge {
+            Merge::Key => keys.push(value),
+            Merge::Sum => aggregates.push(sum(value).alias(merged(i))),
+            Merge::Min => aggregates.push(min(value).alias(merged(i))),
+            Merge::Max => aggregates.push(max(value).alias(merged(i))),
+        }
+        let result = match merge {
+            Merge::Key => column(field.name()),
+            _ => column(&merged(i)),
+        };
+        output.push(cast(result, field.data_type().clone()).alias(field.name()));
+    }
+    let batches = groups
+        .aggregate(keys, aggregates)?
+        .select(output)?
+        .collect()
+        .await?;
+    Ok(concat_batches(schema, &conform(schema, batches)?)?)
+}
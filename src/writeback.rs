@@ -0,0 +1,185 @@
+use datafusion::arrow::datatypes::Schema;
+use datafusion::arrow::error::{ArrowError, Result};
+use datafusion::arrow::ipc::writer::StreamWriter;
+use datafusion::arrow::record_batch::RecordBatch;
+use std::ffi::CString;
+use std::io::Write;
+use std::os::unix::ffi::OsStrExt;
+use std::os::unix::fs::{OpenOptionsExt, PermissionsExt};
+use std::path::{Path, PathBuf};
+use std::sync::Arc;
+use std::thread::JoinHandle;
+use std::time::Duration;
+use tokio::sync::mpsc;
+
+///////////////////////////////////
+// Write-back through FIFO pipes //
+///////////////////////////////////
+
+/* Arrow data uploaded by admins can be stored back into SciDB without ever
+ * landing on disk: each batch is written, as it is decoded, into a named pipe
+ * which a SciDB query reads from the other end. With several pipes, batches
+ * are dealt to them in turn and each is read by a SciDB instance of its own.
+ *
+ * Every pipe has a thread writing it, fed through a short queue, so that
+ * decoding the upload overlaps with SciDB reading what came before. A writer
+ * blocks opening its pipe until the reader does, and writing while the pipe
+ * is full; should the upload fail, the writer leaves the stream in the pipe
+ * truncated, so that SciDB fails the query instead of storing part of the
+ * data.
+ *
+ * Pipes are created readable by the server's user and group only, so SciDB
+ * must run as a member of the server's group.
+ */
+
+// Batches queued for each pipe ahead of its writer
+const PIPE_QUEUE: usize = 4;
+
+// How often writers waiting on a pipe SciDB will no longer open are released
+const RELEASE_INTERVAL: Duration = Duration::from_millis(10);
+
+// The header of an IPC message whose metadata never follows
+const TRUNCATED_MESSAGE: [u8; 8] = [0xff, 0xff, 0xff, 0xff, 0x08, 0x00, 0x00, 0x00];
+
+pub struct Pipes {
+    // Removes the pipes once dropped
+    _dir: tempfile::TempDir,
+    paths: Vec<PathBuf>,
+}
+
+impl Pipes {
+    pub fn new(dir: &Path, count: usize) -> std::io::Result<Self> {
+        let dir = tempfile::Builder::new()
+            .prefix("rustyshim-")
+            .tempdir_in(dir)?;
+        std::fs::set_permissions(dir.path(), std::fs::Permissions::from_mode(0o750))?;
+        let mut paths = vec![];
+        for i in 0..count.max(1) {
+            let path = dir.path().join(format!("pipe-{i}"));
+            let cpath = CString::new(path.as_os_str().as_bytes())?;
+            if unsafe { libc::mkfifo(cpath.as_ptr(), 0o640) } != 0 {
+                return Err(std::io::Error::last_os_error());
+            }
+            paths.push(path);
+        }
+        Ok(Pipes {
+            _dir: dir,
+            paths: paths,
+        })
+    }
+
+    pub fn paths(&self) -> &[PathBuf] {
+        &self.paths
+    }
+
+    // Open and close each pipe for reading, without blocking, so that writers
+    // waiting for a reader proceed, failing on their first write
+    fn release(&self) {
+        for path in &self.paths {
+            let _ = std::fs::OpenOptions::new()
+                .read(true)
+                .custom_flags(libc::O_NONBLOCK)
+                .open(path);
+        }
+    }
+}
+
+pub struct PipeWriter {
+    pipes: Arc<Pipes>,
+    // None marks the end of the data
+    senders: Vec<mpsc::Sender<Option<RecordBatch>>>,
+    threads: Vec<JoinHandle<Result<usize>>>,
+    next: usize,
+}
+
+fn writer_stopped() -> ArrowError {
+    ArrowError::IoError("pipe writer stopped".to_string())
+}
+
+// Write the batches received into the pipe as an IPC stream, returning the
+// number of rows written
+fn write_pipe(
+    path: &Path,
+    schema: &Schema,
+    mut batches: mpsc::Receiver<Option<RecordBatch>>,
+) -> Result<usize> {
+    // Blocks until the reader opens the pipe
+    let file = std::fs::OpenOptions::new().write(true).open(path)?;
+    let mut writer = StreamWriter::try_new(&file, schema)?;
+    let mut rows = 0;
+    while let Some(batch) = batches.blocking_recv() {
+        match batch {
+            Some(batch) => {
+                writer.write(&batch)?;
+                rows += batch.num_rows();
+            }
+            None => {
+                writer.into_inner()?;
+                return Ok(rows);
+            }
+        }
+    }
+
+    // The upload was aborted
+    drop(writer);
+    (&file).write_all(&TRUNCATED_MESSAGE)?;
+    Err(ArrowError::IoError("upload aborted".to_string()))
+}
+
+impl PipeWriter {
+    pub fn new(pipes: Arc<Pipes>, schema: &Schema) -> std::io::Result<Self> {
+        let mut writer = PipeWriter {
+            pipes: pipes.clone(),
+            senders: vec![],
+            threads: vec![],
+            next: 0,
+        };
+        for path in pipes.paths() {
+            let (sender, receiver) = mpsc::channel(PIPE_QUEUE);
+            let (path, schema) = (path.clone(), schema.clone());
+            let thread = std::thread::Builder::new()
+                .name("rustyshim-pipe".to_string())
+                .spawn(move || write_pipe(&path, &schema, receiver))?;
+            writer.senders.push(sender);
+            writer.threads.push(thread);
+        }
+        Ok(writer)
+    }
+
+    // Queue a batch for the next pipe in turn, waiting while its queue is full
+    pub async fn write(&mut self, batch: RecordBatch) -> Result<()> {
+        let sender = self.senders.get(self.next).ok_or_else(writer_stopped)?;
+        self.next = (self.next + 1) % self.senders.len();
+        sender.send(Some(batch)).await.map_err(|_| writer_stopped())
+    }
+
+    // Complete the stream in every pipe
+    pub async fn finish(&mut self) -> Result<()> {
+        for sender in &self.senders {
+            sender.send(None).await.map_err(|_| writer_stopped())?;
+        }
+        Ok(())
+    }
+
+    // Stop queueing batches; writers whose stream is not complete truncate it
+    pub fn abort(&mut self) {
+        self.senders.clear();
+    }
+
+    // Abort, then wait for the writers to stop, returning the number of rows
+    // written; blocks, and must only be called once the reader is done
+    pub fn close(mut self) -> Result<usize> {
+        self.abort();
+        while !self.threads.iter().all(JoinHandle::is_finished) {
+            self.pipes.release();
+            std::thread::sleep(RELEASE_INTERVAL);
+        }
+        let mut rows = 0;
+        for thread in self.threads.drain(..) {
+            rows += thread
+                .join()
+                .map_err(|_| ArrowError::IoError("pipe writer panicked".to_string()))??;
+        }
+        Ok(rows)
+    }
+}